@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# Measures how fast 6c turns the selfhost sources into assembly,
+# in bytes of output per second. Each compiler given is timed in
+# turn, to compare a build from before a change with one after:
+#	./asmbench.sh /tmp/6c.before bin/6c
+
+set -e
+
+SRC="src/cc/cpp.c
+	src/cc/error.c
+	src/cc/foldexpr.c
+	src/cc/intern.c
+	src/cc/hideset.c
+	src/cc/lex.c
+	src/cc/parse.c
+	src/cc/types.c
+	src/cmd/6c/emit.c
+	src/cmd/6c/frontend.c
+	src/cmd/6c/main.c
+	src/ds/map.c
+	src/ds/vec.c
+	src/ds/deque.c
+	src/mem/mem.c
+	src/panic.c"
+ROUNDS=${ROUNDS:-20}
+
+if [ $# -eq 0 ]
+then
+	set -- bin/6c
+fi
+
+for CC in "$@"
+do
+	BYTES=0
+	for C in $SRC
+	do
+		N=`$CC -I src -I src/selfhost -I \`dirname $C\` $C | wc -c`
+		BYTES=`expr $BYTES + $N`
+	done
+	START=`date +%s%N`
+	R=0
+	while [ $R -lt $ROUNDS ]
+	do
+		for C in $SRC
+		do
+			$CC -I src -I src/selfhost -I `dirname $C` $C > /dev/null
+		done
+		R=`expr $R + 1`
+	done
+	END=`date +%s%N`
+	awk -v cc="$CC" -v b="$BYTES" -v r="$ROUNDS" -v ns="`expr $END - $START`" 'BEGIN {
+		s = ns / 1e9
+		printf "%s: %d bytes x %d rounds in %.2fs, %.1f MB/s\n", cc, b, r, s, b * r / s / 1e6
+	}'
+done
@@ -5,16 +5,17 @@ set -e
 SELFHOSTSRC="src/cc/cpp.c
 	src/cc/error.c
 	src/cc/foldexpr.c
+	src/cc/intern.c
+	src/cc/hideset.c
 	src/cc/lex.c
 	src/cc/parse.c
 	src/cc/types.c
 	src/cmd/6c/emit.c
 	src/cmd/6c/frontend.c
 	src/cmd/6c/main.c
-	src/ds/list.c
 	src/ds/map.c
-	src/ds/strset.c
 	src/ds/vec.c
+	src/ds/deque.c
 	src/mem/mem.c
 	src/panic.c"
 SELFHOSTOBJDIR=lib/selfhostobj
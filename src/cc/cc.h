@@ -12,6 +12,9 @@ typedef struct Sym Sym;
 typedef struct StkSlot StkSlot;
 typedef struct Node Node;
 typedef struct Lexer Lexer;
+typedef struct Ident Ident;
+typedef struct Macro Macro;
+typedef struct Hideset Hideset;
 
 /* Token types */
 typedef enum {
@@ -115,10 +118,14 @@ typedef enum {
 	SCAUTO
 } Sclass;
 
+/* A source location packed in 32 bits, error.c decodes it.
+   Each file read is given a range of locations as long as its
+   contents. Locations with MACROLOC set index a table of macro
+   expansions instead. 0 is no location. */
+#define MACROLOC 0x80000000
+
 struct SrcPos {
-	char *file;
-	int   line;
-	int   col;
+	uint32 loc;
 };
 
 typedef enum {
@@ -185,6 +192,9 @@ struct CTy {
 			char *name;
 			Vec  *members;
 			Vec  *exports;
+			Map  *fields; /* Name to StructMember with the offset
+			                 from the start of this struct, covers
+			                 members of anonymous substructs. */
 		} Struct;
 		struct {
 			Vec  *members;
@@ -251,6 +261,7 @@ struct Node {
 	Nodekind t;
 	SrcPos pos;
 	CTy *type;
+	int need; /* Registers to evaluate it, worked out by the backend */
 	union {
 		struct {
 			int     localsz;
@@ -410,6 +421,7 @@ struct Sym {
 		struct {
 			int sclass;
 			char *label;
+			int tentative; /* 1 + index in tentativesyms, or 0 */
 		} Global;
 		struct {
 			StkSlot *slot;
@@ -417,6 +429,8 @@ struct Sym {
 			CTy *functy;
 			int paramidx;
 			int isparam;
+			char *reg; /* Callee saved register holding it, or 0 */
+			int live;  /* Used by the backend's register allocator */
 		} Local;
 		struct {
 			int64 v;
@@ -430,28 +444,39 @@ struct StkSlot {
 	int offset;
 };
 
-#define MAXTOKSZ 4096
-
+/* The lexer walks a file that has been read into memory in one go,
+   token values are taken straight from the buffer. */
 struct Lexer {
-	FILE   *f;
-	SrcPos pos;
-	SrcPos prevpos;
-	SrcPos markpos;
+	char  *path;
+	char  *buf; /* File contents followed by a zero byte */
+	char  *p;   /* Next character */
+	char  *end;
+	char  *tokstart;
+	uint32 base; /* Location of buf[0] */
 	int    nchars;
 	int    indirective;
 	int    ws;
 	int    nl;
 	int    includestate;
-	char   tokval[MAXTOKSZ+1];
+};
+
+/* An interned spelling. Tokens with the same spelling
+   share one Ident, so names can be compared by pointer. */
+struct Ident {
+	char  *name;
+	int    kw;    /* Keyword token kind, or 0 */
+	Macro *macro; /* Current macro definition, or 0 */
+	int    seq;   /* Order of interning, sorts hidesets */
 };
 
 typedef struct Tok Tok;
 struct Tok {
 	Tokkind k;
 	char   *v;
+	Ident  *id; /* Interned value, null for punctuators */
 	int     ws; /* There was whitespace before this token */
 	int     nl; /* There was a newline before this token */
-	StrSet *hs; /* Hideset, the list of tokens expanded to get this token */
+	Hideset *hs; /* Hideset, the macros expanded to get this token */
 	SrcPos  pos;
 };
 
@@ -473,18 +498,34 @@ struct Data {
 void dumpty(CTy *);
 
 /* error.c */
-void errorf(char *, ...) NORETURN;
-void errorposf(SrcPos *, char *, ...) NORETURN;
+void   errorf(char *, ...) NORETURN;
+void   errorposf(SrcPos *, char *, ...) NORETURN;
+uint32 addsrcfile(char *, char *, int);
+uint32 macroloc(SrcPos *, Ident *);
+
+/* hideset.c */
+int      hshas(Hideset *, Ident *);
+Hideset *hsadd(Hideset *, Ident *);
+Hideset *hsunion(Hideset *, Hideset *);
+Hideset *hsintersect(Hideset *, Hideset *);
+
+/* intern.c */
+Ident *intern(char *);
 
 /* lex.c cpp.c */
 void  cppinit(char *, Vec *);
+void  cppreport(FILE *);
 char *tokktostr(Tokkind);
 Tok  *lex(Lexer *);
 Tok  *pp(void);
+void  skipgroup(Lexer *);
 
 /* types.c */
 CTy *newtype(int);
+CTy *copytype(CTy *);
+NameTy *newnamety(char *, CTy *);
 CTy *mkptr(CTy *);
+CTy *canontype(CTy *);
 int isvoid(CTy *);
 int isftype(CTy *);
 int isitype(CTy *);
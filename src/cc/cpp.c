@@ -4,6 +4,8 @@
 #include "cc.h"
 
 #define MAXINCLUDE 128
+#define MAXCOND    1024
+#define MAXPARAMS  128
 
 typedef enum {
 	OBJMACRO,
@@ -11,18 +13,15 @@ typedef enum {
 	BUILTINMACRO,
 } MacroKind;
 
-typedef struct Macro Macro;
+/* Macro bodies are compiled at #define time, parameter
+   references are resolved to indices once instead of being
+   looked up by name on every expansion. */
 struct Macro {
 	MacroKind k;
-	union {
-		struct {
-			Vec  *toks;
-		} Obj;
-		struct {
-			Vec *argnames; /* vec of char * */
-			Vec *toks;
-		} Func;
-	};
+	int  nparams;
+	int  ntoks;
+	Tok *toks;  /* The body */
+	int *param; /* toks[i] names parameter param[i], or is -1 */
 };
 
 int	nlexers;
@@ -30,31 +29,127 @@ Lexer *lexers[MAXINCLUDE];
 
 static Vec *includedirs;
 
-/* List of tokens inserted into the stream */
-static List *toks;
-static Map  *macros;
+/* Tokens pushed back into the stream, the next one first. */
+static Deque *pending;
+/* Tokens produced by macro expansion */
+static Arena *pparena;
+static Ident *definedid;
+
+/* Open conditionals, the innermost last. */
+static int ncond;
+static int condtaken[MAXCOND]; /* Some group of the #if was included */
+static int condelse[MAXCOND];  /* #else was seen */
+static int condbase[MAXINCLUDE]; /* ncond when each lexer was pushed */
+
+/* Include guard detection. A file whose tokens all sit inside
+   #ifndef X ... #endif is guarded by X, including it again while
+   X is defined can be skipped without lexing it. */
+enum {
+	GUARDSTART, /* Nothing seen yet */
+	GUARDIN,    /* Inside the candidate #ifndef */
+	GUARDEND,   /* After its #endif */
+	GUARDNONE,  /* The file is not guarded */
+};
+
+typedef struct {
+	Ident *guard; /* Macro guarding the whole file, or 0 */
+	int    once;  /* The file said #pragma once */
+} Incfile;
+
+static Map   *incfiles; /* Incfile by path */
+static int    guardstate[MAXINCLUDE];
+static Ident *guardmacro[MAXINCLUDE];
+static int    indirective;
+static int    nguardskips;
+
+/* Include resolution caches. resolved maps the spelling, quote
+   style and including directory of an #include to its path.
+   missing holds every dir/name path that failed to open. */
+static Map  *resolved;
+static Map  *missing;
+static char *lexdir[MAXINCLUDE]; /* Directory of each open file */
 
 static Tok *ppnoexpand();
-static int64 ifexpr();
 
 static void
-pushlex(char *path)
+pushtok(Tok *t)
+{
+	dqpushfront(pending, t);
+}
+
+/* Pushes the n tokens at blk so that blk[0] comes next,
+   growing the deque at most once. */
+static void
+pushblock(Tok *blk, int n)
+{
+	int i;
+
+	dqreserve(pending, pending->len + n);
+	for(i = n - 1; i >= 0; i--)
+		dqpushfront(pending, &blk[i]);
+}
+static int64 ifexpr(Tok *);
+
+/* Read the whole file in one go, the lexer
+   walks the buffer instead of calling stdio per character.
+   f is the already opened file, or null. */
+static void
+readsrc(Lexer *l, char *path, FILE *f)
+{
+	long  n;
+
+	if(!f)
+		f = fopen(path, "r");
+	if(!f)
+		errorf("error opening file %s\n", path);
+	if(fseek(f, 0, SEEK_END) != 0)
+		errorf("error seeking file %s\n", path);
+	n = ftell(f);
+	if(n < 0 || fseek(f, 0, SEEK_SET) != 0)
+		errorf("error seeking file %s\n", path);
+	l->buf = arenaalloc(pparena, n + 1);
+	if((long)fread(l->buf, 1, n, f) != n)
+		errorf("error reading file %s\n", path);
+	fclose(f);
+	l->p = l->buf;
+	l->end = l->buf + n;
+	l->base = addsrcfile(path, l->buf, n);
+}
+
+static char *
+pathdir(char *path)
+{
+	int   i, n;
+	char *d;
+
+	n = -1;
+	for(i = 0; path[i]; i++)
+		if(path[i] == '/')
+			n = i;
+	if(n < 0)
+		return ".";
+	if(n == 0)
+		return "/";
+	d = xmalloc(n + 1);
+	strncpy(d, path, n);
+	return d;
+}
+
+static void
+pushlex(char *path, FILE *f)
 {
 	Lexer *l;
 
 	if(nlexers == MAXINCLUDE)
 		panic("include depth limit reached!");
 	l = xmalloc(sizeof(Lexer));
-	l->pos.file = path;
-	l->prevpos.file = path;
-	l->markpos.file = path;
-	l->pos.line = 1;
-	l->pos.col = 1;
+	l->path = path;
 	l->nl = 1;
-	l->f = fopen(path, "r");
-	if (!l->f)
-		errorf("error opening file %s\n", path);
+	readsrc(l, path, f);
 	lexers[nlexers] = l;
+	lexdir[nlexers] = pathdir(path);
+	condbase[nlexers] = ncond;
+	guardstate[nlexers] = GUARDSTART;
 	nlexers += 1;
 }
 
@@ -62,34 +157,89 @@ static void
 poplex()
 {
 	nlexers--;
-	fclose(lexers[nlexers]->f);
 }
 
-static int
-fileexists(char *fname)
+/* Opens name in dir, a null dir means name is used as is.
+   Paths that failed to open are remembered and never tried again. */
+static char *
+probe(char *dir, char *name, FILE **fp)
 {
-	FILE *f;
+	char  buf[4096];
+	char *path;
 
-	f = fopen(fname, "r");
-	if(!f)
+	if(!dir)
+		snprintf(buf, sizeof(buf), "%s", name);
+	else
+		snprintf(buf, sizeof(buf), "%s/%s", dir, name);
+	if(mapget(missing, buf))
 		return 0;
-	fclose(f);
-	return 1;
+	path = xstrdup(buf);
+	*fp = fopen(path, "r");
+	if(!*fp) {
+		mapset(missing, path, path);
+		return 0;
+	}
+	return path;
 }
 
+/* Returns the path name resolves to, or null. *fp is set to the
+   opened file, or null when the path came from the cache and the
+   file has not been opened. Quoted includes look in the directory
+   of the including file before the include path. */
 static char *
-findinclude(char *path, int issysinclude)
+findinclude(char *name, int sysinclude, FILE **fp)
 {
-	int i;
-	char buf[4096];
-	
-	/* XXX check current dir */
-	/* XXX proper path join */
-	for(i = 0; i < includedirs->len; i++) {
-		snprintf(buf, sizeof(buf), "%s/%s", (char*)vecget(includedirs, i), path);
-		if(fileexists(buf))
-			return xstrdup(buf);
+	int   i;
+	char  key[4096];
+	char *path, *dir;
+
+	dir = "";
+	if(!sysinclude)
+		dir = lexdir[nlexers - 1];
+	snprintf(key, sizeof(key), "%d:%s:%s", sysinclude, dir, name);
+	*fp = 0;
+	path = mapget(resolved, key);
+	if(path)
+		return path;
+	if(name[0] == '/') {
+		path = probe(0, name, fp);
+	} else {
+		if(!sysinclude)
+			path = probe(dir, name, fp);
+		for(i = 0; !path && i < includedirs->len; i++)
+			path = probe(vecget(includedirs, i), name, fp);
 	}
+	if(path)
+		mapset(resolved, xstrdup(key), path);
+	return path;
+}
+
+static Incfile *
+incfile(char *path)
+{
+	Incfile *inc;
+
+	inc = mapget(incfiles, path);
+	if(!inc) {
+		inc = xmalloc(sizeof(Incfile));
+		mapset(incfiles, path, inc);
+	}
+	return inc;
+}
+
+/* Including path again would produce no tokens. */
+static int
+skipinclude(char *path)
+{
+	Incfile *inc;
+
+	inc = mapget(incfiles, path);
+	if(!inc)
+		return 0;
+	if(inc->once)
+		return 1;
+	if(inc->guard && inc->guard->macro)
+		return 1;
 	return 0;
 }
 
@@ -101,6 +251,7 @@ include()
 	char *path, *fullpath;
 	SrcPos *pos;
 	int  sysinclude;
+	FILE *f;
 
 	t = ppnoexpand();
 	pos = &t->pos;
@@ -114,10 +265,16 @@ include()
 	t = ppnoexpand();
 	if(t->k != TOKDIREND)
 		errorposf(&t->pos, "garbage at end of #include (%s)", tokktostr(t->k));
-	fullpath = findinclude(path, sysinclude);
+	fullpath = findinclude(path, sysinclude, &f);
 	if(!fullpath)
 		errorposf(pos, "could not find header %s", path);
-	pushlex(fullpath);
+	if(skipinclude(fullpath)) {
+		if(f)
+			fclose(f);
+		nguardskips++;
+		return;
+	}
+	pushlex(fullpath, f);
 }
 
 static int
@@ -136,7 +293,7 @@ lookupmacro(Tok *t)
 {
 	if(!validmacrotok(t->k))
 		return 0;
-	return mapget(macros, t->v);
+	return t->id->macro;
 }
 
 static void
@@ -144,6 +301,8 @@ define()
 {
 	Macro *m;
 	Tok   *n, *t;
+	Vec   *params, *body;
+	int    i, j;
 
 	n = ppnoexpand();
 	if(!validmacrotok(n->k))
@@ -151,37 +310,48 @@ define()
 	if(lookupmacro(n))
 		errorposf(&n->pos, "redefinition of macro %s", n->v);
 	m = xmalloc(sizeof(Macro));
+	params = vec();
+	body = vec();
 	t = ppnoexpand();
 	if(t->k == '(' && !t->ws) {
 		m->k = FUNCMACRO;
-		m->Func.toks = vec();
-		m->Func.argnames = vec();
-		for(;;) {
-			t = ppnoexpand();
+		t = ppnoexpand();
+		while(t->k != ')') {
 			if(t->k != TOKIDENT)
 				errorposf(&t->pos, "invalid macro argname");
-			vecappend(m->Func.argnames, t->v);
+			if(params->len == MAXPARAMS)
+				errorposf(&t->pos, "too many macro parameters");
+			vecappend(params, t->id);
 			t = ppnoexpand();
 			if(t->k == ')')
 				break;
 			if(t->k != ',')
 				errorposf(&t->pos, "preprocessor expected ','");
-		}
-		while(1) {
 			t = ppnoexpand();
-			if(t->k == TOKDIREND)
-				break;
-			vecappend(m->Func.toks, t);
 		}
+		t = ppnoexpand();
 	} else {
 		m->k = OBJMACRO;
-		m->Obj.toks = vec();
-		while(t->k != TOKDIREND) {
-			vecappend(m->Obj.toks, t);
-			t = ppnoexpand();
-		}
 	}
-	mapset(macros, n->v, m);
+	while(t->k != TOKDIREND) {
+		vecappend(body, t);
+		t = ppnoexpand();
+	}
+	m->nparams = params->len;
+	m->ntoks = body->len;
+	m->toks = xmalloc(m->ntoks * sizeof(Tok));
+	m->param = xmalloc(m->ntoks * sizeof(int));
+	for(i = 0; i < m->ntoks; i++) {
+		t = vecget(body, i);
+		m->toks[i] = *t;
+		m->param[i] = -1;
+		if(t->k != TOKIDENT)
+			continue;
+		for(j = 0; j < params->len; j++)
+			if(t->id == vecget(params, j))
+				m->param[i] = j;
+	}
+	n->id->macro = m;
 }
 
 static void
@@ -192,51 +362,563 @@ undef()
 	t = ppnoexpand();
 	if(!lookupmacro(t))
 		errorposf(&t->pos, "cannot #undef macro that isn't defined");
-	mapdel(macros, t->v);
+	t->id->macro = 0;
 	t = ppnoexpand();
 	if(t->k != TOKDIREND)
 		errorposf(&t->pos, "garbage at end of #undef");
 }
 
 static void
-pif()
+enddirective(char *dir)
 {
-	ifexpr();
-	panic("unimplemented");
+	Tok *t;
+
+	t = ppnoexpand();
+	if(t->k != TOKDIREND)
+		errorposf(&t->pos, "garbage at end of #%s", dir);
 }
 
 static void
-elseif()
+pushcond(SrcPos *pos, int taken)
 {
-	panic("unimplemented");
+	if(ncond == MAXCOND)
+		errorposf(pos, "#if nested too deeply");
+	condtaken[ncond] = taken;
+	condelse[ncond] = 0;
+	ncond++;
+	if(!taken)
+		skipgroup(lexers[nlexers - 1]);
 }
 
 static void
-pelse()
+checkcond(Tok *dir)
 {
-	panic("unimplemented");
+	if(ncond == condbase[nlexers - 1])
+		errorposf(&dir->pos, "#%s without #if", dir->v);
 }
 
 static void
-endif()
+pif(Tok *dir)
 {
-	panic("unimplemented");
+	pushcond(&dir->pos, ifexpr(dir) != 0);
 }
 
+static void
+ifdef(Tok *dir, int want)
+{
+	Tok *t;
+
+	t = ppnoexpand();
+	if(!validmacrotok(t->k))
+		errorposf(&t->pos, "#%s expects a macro name", dir->v);
+	enddirective(dir->v);
+	pushcond(&dir->pos, (lookupmacro(t) != 0) == want);
+}
+
+static void
+elif(Tok *dir)
+{
+	Tok *t;
+
+	checkcond(dir);
+	if(condelse[ncond - 1])
+		errorposf(&dir->pos, "#elif after #else");
+	if(condtaken[ncond - 1]) {
+		do
+			t = ppnoexpand();
+		while(t->k != TOKDIREND);
+		skipgroup(lexers[nlexers - 1]);
+		return;
+	}
+	if(ifexpr(dir))
+		condtaken[ncond - 1] = 1;
+	else
+		skipgroup(lexers[nlexers - 1]);
+}
+
+static void
+pelse(Tok *dir)
+{
+	checkcond(dir);
+	if(condelse[ncond - 1])
+		errorposf(&dir->pos, "#else after #else");
+	condelse[ncond - 1] = 1;
+	enddirective(dir->v);
+	if(condtaken[ncond - 1])
+		skipgroup(lexers[nlexers - 1]);
+	else
+		condtaken[ncond - 1] = 1;
+}
+
+static void
+endif(Tok *dir)
+{
+	checkcond(dir);
+	enddirective(dir->v);
+	ncond--;
+}
+
+/* The #if expression being evaluated, after macro expansion. */
+static Vec *iftoks;
+static Tok *ifend;
+static int  ifidx;
+
+/* #if arithmetic is done in long or unsigned long, values are kept
+   as int64 and ifuns says whether the value just evaluated is
+   unsigned. The unsigned operators are written with signed compares
+   and shifts only, so they hold when the compiler compiles itself. */
+#define SIGNBIT (-9223372036854775807LL - 1)
+
+static int ifuns;
+
+static int
+ifultu(int64 a, int64 b)
+{
+	return (a ^ SIGNBIT) < (b ^ SIGNBIT);
+}
+
+static int64
+ifshru(int64 v, int64 n)
+{
+	if(n == 0)
+		return v;
+	return (v >> n) & ~(SIGNBIT >> (n - 1));
+}
+
+/* Unsigned division, *rem is set to the remainder. */
 static int64
-ifexpr()
+ifdivu(int64 a, int64 b, int64 *rem)
 {
+	int64 q, r;
+
+	if(a >= 0 && b >= 0) {
+		*rem = a % b;
+		return a / b;
+	}
+	if(b < 0) {
+		if(ifultu(a, b)) {
+			*rem = a;
+			return 0;
+		}
+		*rem = (int64)((uint64)a - (uint64)b);
+		return 1;
+	}
+	/* b fits in 63 bits, so a/2 can be divided signed. */
+	q = (ifshru(a, 1) / b) << 1;
+	r = (int64)((uint64)a - (uint64)q * (uint64)b);
+	if(!ifultu(r, b)) {
+		q += 1;
+		r = (int64)((uint64)r - (uint64)b);
+	}
+	*rem = r;
+	return q;
+}
+
+/* Numbers with a u suffix are unsigned, as are those too big for long. */
+static int64
+ifnum(Tok *t)
+{
+	char  *s;
+	int64  v;
+
+	v = (int64)strtoull(t->v, &s, 0);
+	ifuns = v < 0;
+	for(; *s; s++)
+		if(*s == 'u' || *s == 'U')
+			ifuns = 1;
+	return v;
+}
+
+static Tok *
+ifpeek()
+{
+	if(ifidx == iftoks->len)
+		return ifend;
+	return vecget(iftoks, ifidx);
+}
+
+static Tok *
+ifnext()
+{
+	Tok *t;
+
+	t = ifpeek();
+	if(ifidx != iftoks->len)
+		ifidx++;
+	return t;
+}
+
+/* Replaces defined X or defined(X) with 1 or 0,
+   this has to happen before macro expansion. */
+static Tok *
+ifdefined(Tok *t)
+{
+	Tok *n, *r;
+
+	n = ppnoexpand();
+	if(n->k == '(') {
+		n = ppnoexpand();
+		r = ppnoexpand();
+		if(r->k != ')')
+			errorposf(&r->pos, "expected ')' after defined");
+	}
+	if(!validmacrotok(n->k))
+		errorposf(&n->pos, "defined expects a macro name");
+	r = arenaalloc(pparena, sizeof(Tok));
+	*r = *t;
+	r->k = TOKNUM;
+	if(lookupmacro(n))
+		r->id = intern("1");
+	else
+		r->id = intern("0");
+	r->v = r->id->name;
+	return r;
+}
+
+static int64
+ifcharlit(Tok *t)
+{
+	char *s;
+
+	s = t->v + 1;
+	if(s[0] != '\\')
+		return s[0];
+	switch(s[1]) {
+	case 'n':
+		return '\n';
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case '0':
+		return 0;
+	default:
+		return s[1];
+	}
+}
+
+static int64 ifcond(int);
+
+static int64
+ifunary(int eval)
+{
+	Tok  *t;
+	int64 v;
+
+	t = ifnext();
+	switch(t->k) {
+	case '+':
+		return ifunary(eval);
+	case '-':
+		return (int64)(0 - (uint64)ifunary(eval));
+	case '!':
+		v = !ifunary(eval);
+		ifuns = 0;
+		return v;
+	case '~':
+		return ~ifunary(eval);
+	case '(':
+		v = ifcond(eval);
+		t = ifnext();
+		if(t->k != ')')
+			errorposf(&t->pos, "expected ')' in #if");
+		return v;
+	case TOKNUM:
+		return ifnum(t);
+	case TOKCHARLIT:
+		ifuns = 0;
+		return ifcharlit(t);
+	case TOKIDENT:
+		ifuns = 0;
+		return 0;
+	default:
+		/* Identifiers left after expansion are 0, keywords too. */
+		ifuns = 0;
+		if(t->id && t->id->kw)
+			return 0;
+		errorposf(&t->pos, "invalid token in #if: %s", tokktostr(t->k));
+	}
 	return 0;
 }
 
+static int
+ifprec(Tokkind k)
+{
+	switch(k) {
+	case TOKLOR:
+		return 1;
+	case TOKLAND:
+		return 2;
+	case '|':
+		return 3;
+	case '^':
+		return 4;
+	case '&':
+		return 5;
+	case TOKEQL:
+	case TOKNEQ:
+		return 6;
+	case '<':
+	case '>':
+	case TOKLEQ:
+	case TOKGEQ:
+		return 7;
+	case TOKSHL:
+	case TOKSHR:
+		return 8;
+	case '+':
+	case '-':
+		return 9;
+	case '*':
+	case '/':
+	case '%':
+		return 10;
+	default:
+		return 0;
+	}
+}
+
+/* Precedence climbing. When eval is 0 the operands are on the
+   untaken side of &&, || or ?: and division by zero is ignored. */
+static int64
+ifbinop(int minprec, int eval)
+{
+	Tok  *t;
+	int   prec, lu, u;
+	int64 l, r, rem;
+
+	l = ifunary(eval);
+	for(;;) {
+		t = ifpeek();
+		prec = ifprec(t->k);
+		if(prec == 0 || prec < minprec)
+			return l;
+		ifidx++;
+		switch(t->k) {
+		case TOKLOR:
+			r = ifbinop(prec + 1, eval && !l);
+			l = l || r;
+			ifuns = 0;
+			continue;
+		case TOKLAND:
+			r = ifbinop(prec + 1, eval && l);
+			l = l && r;
+			ifuns = 0;
+			continue;
+		default:
+			break;
+		}
+		lu = ifuns;
+		r = ifbinop(prec + 1, eval);
+		/* The usual conversions, shifts take the left type. */
+		u = lu || ifuns;
+		ifuns = u;
+		switch(t->k) {
+		case '|':    l = l | r; break;
+		case '^':    l = l ^ r; break;
+		case '&':    l = l & r; break;
+		case TOKEQL: l = l == r; ifuns = 0; break;
+		case TOKNEQ: l = l != r; ifuns = 0; break;
+		case '<':
+			if(u)
+				l = ifultu(l, r);
+			else
+				l = l < r;
+			ifuns = 0;
+			break;
+		case '>':
+			if(u)
+				l = ifultu(r, l);
+			else
+				l = l > r;
+			ifuns = 0;
+			break;
+		case TOKLEQ:
+			if(u)
+				l = !ifultu(r, l);
+			else
+				l = l <= r;
+			ifuns = 0;
+			break;
+		case TOKGEQ:
+			if(u)
+				l = !ifultu(l, r);
+			else
+				l = l >= r;
+			ifuns = 0;
+			break;
+		case TOKSHL:
+			l = (int64)((uint64)l << r);
+			ifuns = lu;
+			break;
+		case TOKSHR:
+			if(lu)
+				l = ifshru(l, r);
+			else
+				l = l >> r;
+			ifuns = lu;
+			break;
+		case '+':    l = (int64)((uint64)l + (uint64)r); break;
+		case '-':    l = (int64)((uint64)l - (uint64)r); break;
+		case '*':    l = (int64)((uint64)l * (uint64)r); break;
+		case '/':
+		case '%':
+			if(r == 0) {
+				if(eval)
+					errorposf(&t->pos, "division by zero in #if");
+				l = 0;
+			} else if(u) {
+				l = ifdivu(l, r, &rem);
+				if(t->k == '%')
+					l = rem;
+			} else if(l == SIGNBIT && r == -1) {
+				/* The quotient does not fit, and idiv traps. */
+				if(eval)
+					errorposf(&t->pos, "overflow in #if");
+				l = 0;
+			} else if(t->k == '/') {
+				l = l / r;
+			} else {
+				l = l % r;
+			}
+			break;
+		default:
+			panic("internal error");
+		}
+	}
+}
+
+static int64
+ifcond(int eval)
+{
+	Tok  *t;
+	int64 c, a, b;
+	int   u;
+
+	c = ifbinop(1, eval);
+	t = ifpeek();
+	if(t->k != '?')
+		return c;
+	ifidx++;
+	a = ifcond(eval && c);
+	u = ifuns;
+	t = ifnext();
+	if(t->k != ':')
+		errorposf(&t->pos, "expected ':' in #if");
+	b = ifcond(eval && !c);
+	ifuns = u || ifuns;
+	if(c)
+		return a;
+	return b;
+}
+
+/* Reads the rest of the directive line, expands it
+   and evaluates it as an integer constant expression. */
+static int64
+ifexpr(Tok *dir)
+{
+	Tok  *t;
+	Vec  *raw;
+	int   i;
+	int64 v;
+
+	raw = vec();
+	for(;;) {
+		t = ppnoexpand();
+		if(t->k == TOKDIREND)
+			break;
+		if(t->k == TOKIDENT && t->id == definedid)
+			t = ifdefined(t);
+		vecappend(raw, t);
+	}
+	if(raw->len == 0)
+		errorposf(&dir->pos, "#%s with no expression", dir->v);
+	/* The directive end stops pp at the end of the line. */
+	pushtok(t);
+	for(i = raw->len - 1; i >= 0; i--)
+		pushtok(vecget(raw, i));
+	iftoks = vec();
+	for(;;) {
+		t = pp();
+		if(t->k == TOKDIREND)
+			break;
+		vecappend(iftoks, t);
+	}
+	ifend = t;
+	ifidx = 0;
+	v = ifcond(1);
+	if(ifidx != iftoks->len) {
+		t = ifpeek();
+		errorposf(&t->pos, "garbage at end of #%s", dir->v);
+	}
+	return v;
+}
+
+/* Only #pragma once is understood, other pragmas are ignored. */
+static void
+pragma()
+{
+	Tok *t;
+
+	t = ppnoexpand();
+	if(t->k == TOKIDENT && strcmp(t->v, "once") == 0)
+		incfile(lexers[nlexers - 1]->path)->once = 1;
+	while(t->k != TOKDIREND)
+		t = ppnoexpand();
+}
+
+/* Moves the guard state of the current file along for a directive
+   named by dir, called before the directive is acted on. */
+static void
+guarddirective(Tok *dir)
+{
+	int *state;
+
+	state = &guardstate[nlexers - 1];
+	switch(*state) {
+	case GUARDSTART:
+		if(strcmp(dir->v, "ifndef") != 0) {
+			*state = GUARDNONE;
+			break;
+		}
+		/* Peek at the macro name, ifdef() reads it again. */
+		dir = ppnoexpand();
+		pushtok(dir);
+		if(dir->k != TOKIDENT) {
+			*state = GUARDNONE;
+			break;
+		}
+		guardmacro[nlexers - 1] = dir->id;
+		*state = GUARDIN;
+		break;
+	case GUARDIN:
+		if(ncond != condbase[nlexers - 1] + 1)
+			break;
+		if(strcmp(dir->v, "endif") == 0)
+			*state = GUARDEND;
+		else if(strcmp(dir->v, "elif") == 0 || strcmp(dir->v, "else") == 0)
+			*state = GUARDNONE;
+		break;
+	case GUARDEND:
+		*state = GUARDNONE;
+		break;
+	}
+}
+
 static void
 directive()
 {
 	Tok  *t;
 	char *dir;
 
+	indirective = 1;
 	t = ppnoexpand();
+	if(t->k == TOKDIREND) {
+		indirective = 0;
+		return;
+	}
 	dir = t->v;
+	guarddirective(t);
 	if(strcmp(dir, "include") == 0)
 		include();
 	else if(strcmp(dir, "define") == 0)
@@ -244,15 +926,22 @@ directive()
 	else if(strcmp(dir, "undef") == 0)
 		undef();
 	else if(strcmp(dir, "if") == 0)
-		pif();
-	else if(strcmp(dir, "elseif") == 0)
-		elseif();
+		pif(t);
+	else if(strcmp(dir, "ifdef") == 0)
+		ifdef(t, 1);
+	else if(strcmp(dir, "ifndef") == 0)
+		ifdef(t, 0);
+	else if(strcmp(dir, "elif") == 0)
+		elif(t);
 	else if(strcmp(dir, "else") == 0)
-		pelse();
+		pelse(t);
 	else if(strcmp(dir, "endif") == 0)
-		endif();
+		endif(t);
+	else if(strcmp(dir, "pragma") == 0)
+		pragma();
 	else
 		errorposf(&t->pos, "invalid directive %s", dir);
+	indirective = 0;
 }
 
 static struct {char *kw; int t;} keywordlut[] = {
@@ -292,15 +981,9 @@ static struct {char *kw; int t;} keywordlut[] = {
 };
 
 static int
-identkind(char *s) {
-	int i;
-
-	i = 0;
-	while(keywordlut[i].kw) {
-		if(strcmp(keywordlut[i].kw, s) == 0)
-			return keywordlut[i].t;
-		i++;
-	}
+identkind(Ident *id) {
+	if(id->kw)
+		return id->kw;
 	return TOKIDENT;
 }
 
@@ -309,9 +992,16 @@ ppnoexpand()
 {
 	Tok *t;
 
-	if(toks->len)
-		return listpopfront(toks);
+	if(pending->len)
+		return dqpopfront(pending);
 	t = lex(lexers[nlexers - 1]);
+	if(t->k == TOKEOF && ncond != condbase[nlexers - 1])
+		errorposf(&t->pos, "unterminated #if");
+	if(t->k == TOKEOF && guardstate[nlexers - 1] == GUARDEND)
+		incfile(lexers[nlexers - 1]->path)->guard = guardmacro[nlexers - 1];
+	if(t->k != TOKEOF && t->k != TOKDIRSTART && !indirective)
+	if(guardstate[nlexers - 1] != GUARDIN)
+		guardstate[nlexers - 1] = GUARDNONE;
 	if(t->k == TOKEOF && nlexers == 1)
 		return t;
 	if(t->k == TOKEOF && nlexers > 1) {
@@ -319,111 +1009,131 @@ ppnoexpand()
 		return ppnoexpand();
 	}
 	if(t->k == TOKIDENT)
-		t->k = identkind(t->v);
+		t->k = identkind(t->id);
 	return t;
 }
 
-/* TODO, inline? it isn't really too clear by itself */
+/* Pushes the expansion of a function-like macro. args holds the
+   argument tokens with a null entry between arguments. The whole
+   expansion is copied into a single block of tokens. */
 static void
-expandfunclike(SrcPos *pos, Macro *m, Vec *params, StrSet *hs)
-{
-	int i, j, k, argfound;
-	Tok *t1, *t2;
-	Vec *v, *expanded;
-
-	if(m->k != FUNCMACRO)
-		panic("internal error");
-	if(m->Func.argnames->len != params->len)
-		panic("internal error");
-	expanded = vec();
-	for(i = 0; i < m->Func.toks->len; i++) {
-		t1 = vecget(m->Func.toks, i);
-		argfound = 0;
-		for(j = 0; j < m->Func.argnames->len; j++) {
-			if(strcmp(t1->v, vecget(m->Func.argnames, j)) == 0) {
-				v = vecget(params, j);
-				for(k = 0; k < v->len; k++) {
-					t2 = xmalloc(sizeof(Tok));
-					*t2 = *(Tok*)(vecget(v, k));
-					t2->pos = *pos;
-					t2->hs = hs;
-					vecappend(expanded, t2);
-				}
-				argfound = 1;
-				break;
-			}
+expandfunclike(Tok *name, Macro *m, Vec *args, Hideset *hs)
+{
+	int    i, j, n, p;
+	uint32 loc;
+	int  start[MAXPARAMS + 1];
+	Tok *blk;
+
+	j = 0;
+	start[0] = 0;
+	for(i = 0; i < args->len; i++) {
+		if(!vecget(args, i)) {
+			j++;
+			start[j] = i + 1;
 		}
-		if(!argfound) {
-			t2 = xmalloc(sizeof(Tok));
-			*t2 = *t1;
-			t2->pos = *pos;
-			t2->hs = hs;
-			vecappend(expanded, t2);
+	}
+	start[m->nparams] = args->len + 1;
+	n = 0;
+	for(i = 0; i < m->ntoks; i++) {
+		p = m->param[i];
+		if(p < 0)
+			n++;
+		else
+			n += start[p + 1] - 1 - start[p];
+	}
+	blk = arenaalloc(pparena, n * sizeof(Tok));
+	n = 0;
+	for(i = 0; i < m->ntoks; i++) {
+		p = m->param[i];
+		if(p < 0) {
+			blk[n] = m->toks[i];
+			n++;
+			continue;
+		}
+		for(j = start[p]; j < start[p + 1] - 1; j++) {
+			blk[n] = *(Tok*)vecget(args, j);
+			n++;
 		}
 	}
-	for(i = 0; i < expanded->len; i++)
-		listprepend(toks, vecget(expanded, expanded->len - i - 1));
+	/* The whole expansion shares one location, that of
+	   the invocation tagged with the macro name. */
+	loc = macroloc(&name->pos, name->id);
+	for(i = 0; i < n; i++) {
+		blk[i].pos.loc = loc;
+		blk[i].hs = hsunion(blk[i].hs, hs);
+	}
+	pushblock(blk, n);
 }
 
 Tok *
 pp()
 {
-	int	i, depth;
+	int	i, depth, nargs;
 	Macro  *m;
-	Vec	*params, *curparam;
-	Tok	*t1, *t2, *expanded;
-	StrSet *hsparen, *hsmacro;
+	Vec	*args;
+	Tok	*t1, *t2, *blk;
+	Hideset *hs, *hsparen;
+	Arena   *prev;
 
 	t1 = ppnoexpand();
-	if(t1->k == TOKDIRSTART && toks->len == 0) {
+	if(t1->k == TOKDIRSTART && pending->len == 0) {
+		/* Macros and include state outlive whatever the
+		   parser is allocating at the time. */
+		prev = setarena(pparena);
 		directive();
+		setarena(prev);
 		return pp();
 	}
 	m = lookupmacro(t1);
 	if(!m)
 		return t1;
-	hsmacro = t1->hs;
+	if(hshas(t1->hs, t1->id))
+		return t1;
 	switch(m->k) {
 	case FUNCMACRO:
 		t2 = pp();
 		if(t2->k != '(') {
-			listprepend(toks, t2);
+			pushtok(t2);
 			return t1;
 		}
-		params = vec();
+		args = vec();
+		nargs = 1;
 		depth = 1;
 		for(;;) {
 			t2 = pp();
 			if(t2->k == TOKEOF)
 				errorposf(&t2->pos, "end of file in macro arguments");
+			if(t2->k == TOKDIREND)
+				errorposf(&t2->pos, "end of line in macro arguments");
 			if(t2->k == ')' && depth == 1) {
 				hsparen = t2->hs;
 				break;
 			}
-			if(params->len == 0 || (t2->k == ',' && depth == 1)) {
-				curparam = vec();
-				vecappend(params, curparam);
+			if(t2->k == ',' && depth == 1) {
+				vecappend(args, 0);
+				nargs++;
+				continue;
 			}
-			if(t2->k != ',')
-				vecappend(curparam, t2);
 			if(t2->k == '(')
 				depth++;
 			if(t2->k == ')')
 				depth--;
+			vecappend(args, t2);
 		}
-		if(m->Func.argnames->len != params->len)
+		if(args->len == 0 && m->nparams == 0)
+			nargs = 0;
+		if(nargs != m->nparams)
 			errorposf(&t1->pos, "macro invoked with incorrect number of args");
-		expandfunclike(&t1->pos, m, params, strsetadd(strsetintersect(hsmacro, hsparen), t1->v));
+		expandfunclike(t1, m, args, hsadd(hsintersect(t1->hs, hsparen), t1->id));
 		return pp();
 	case OBJMACRO:
-		if(strsethas(t1->hs, t1->v))
-			return t1;
-		for(i = 0; i < m->Obj.toks->len; i++) {
-			expanded = xmalloc(sizeof(Tok));
-			*expanded = *(Tok*)vecget(m->Obj.toks, m->Obj.toks->len - i - 1);
-			expanded->hs = strsetadd(expanded->hs, t1->v);
-			listprepend(toks, expanded);
+		hs = hsadd(t1->hs, t1->id);
+		blk = arenaalloc(pparena, m->ntoks * sizeof(Tok));
+		for(i = 0; i < m->ntoks; i++) {
+			blk[i] = m->toks[i];
+			blk[i].hs = hs;
 		}
+		pushblock(blk, m->ntoks);
 		return pp();
 	default:
 		;
@@ -435,10 +1145,26 @@ pp()
 void
 cppinit(char *path, Vec *includes)
 {
+	int i;
+
 	includedirs = includes;
 	nlexers = 0;
-	toks = list();
-	macros = map();
-	pushlex(path);
+	pending = deque();
+	for(i = 0; keywordlut[i].kw; i++)
+		intern(keywordlut[i].kw)->kw = keywordlut[i].t;
+	pparena = newarena();
+	definedid = intern("defined");
+	incfiles = map();
+	resolved = map();
+	missing = map();
+	nguardskips = 0;
+	ncond = 0;
+	pushlex(path, 0);
 }
 
+/* Prints preprocessor statistics to f. */
+void
+cppreport(FILE *f)
+{
+	fprintf(f, "cpp: %d includes skipped by include guards or #pragma once\n", nguardskips);
+}
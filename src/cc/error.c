@@ -1,43 +1,171 @@
 #include <u.h>
+#include <mem/mem.h>
 #include <ds/ds.h>
 #include "cc.h"
 
+/* Source locations are decoded only when an error is reported.
+   Every file the lexer reads is registered here along with its
+   contents, lines are found by searching a table of line starts
+   that is only built for files that end up in a diagnostic. */
+
+typedef struct SrcFile SrcFile;
+struct SrcFile {
+	char   *path;
+	char   *buf;
+	int     len;
+	uint32  base;
+	int    *lines; /* Offset of each line start, built lazily */
+	int     nlines;
+};
+
+typedef struct Expansion Expansion;
+struct Expansion {
+	uint32  at; /* Location of the invocation */
+	Ident  *macro;
+};
+
+static Arena   *locarena;
+static Vec     *srcfiles;
+static Vec     *expansions;
+static uint32   nextbase = 1;
+
+/* Registers the contents of a file, returning the location of its
+   first byte. One extra location is kept for the end of the file. */
+uint32
+addsrcfile(char *path, char *buf, int len)
+{
+	SrcFile *f;
+	Arena   *prev;
+
+	if(!srcfiles) {
+		locarena = newarena();
+		prev = setarena(locarena);
+		srcfiles = vec();
+		expansions = vec();
+		setarena(prev);
+	}
+	f = arenaalloc(locarena, sizeof(SrcFile));
+	f->path = path;
+	f->buf = buf;
+	f->len = len;
+	f->base = nextbase;
+	nextbase = nextbase + len + 1;
+	if(nextbase >= MACROLOC)
+		errorf("too much source\n");
+	vecappend(srcfiles, f);
+	return f->base;
+}
+
+/* Returns a location standing for the expansion of macro at *at. */
+uint32
+macroloc(SrcPos *at, Ident *macro)
+{
+	Expansion *e;
+
+	e = arenaalloc(locarena, sizeof(Expansion));
+	e->at = at->loc;
+	e->macro = macro;
+	vecappend(expansions, e);
+	return MACROLOC | (expansions->len - 1);
+}
+
+static SrcFile *
+findfile(uint32 loc)
+{
+	SrcFile *f;
+	int      lo, hi, mid;
+
+	if(!srcfiles || loc == 0)
+		return 0;
+	lo = 0;
+	hi = srcfiles->len - 1;
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		f = vecget(srcfiles, mid);
+		if(f->base <= loc)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return vecget(srcfiles, lo);
+}
+
 static void
-printpos(SrcPos *p)
+buildlines(SrcFile *f)
+{
+	int i, n;
+
+	n = 1;
+	for(i = 0; i < f->len; i++)
+		if(f->buf[i] == '\n')
+			n++;
+	f->lines = arenaalloc(locarena, n * sizeof(int));
+	f->lines[0] = 0;
+	n = 1;
+	for(i = 0; i < f->len; i++)
+		if(f->buf[i] == '\n')
+			f->lines[n++] = i + 1;
+	f->nlines = n;
+}
+
+/* Index of the line holding offset off. */
+static int
+findline(SrcFile *f, int off)
+{
+	int lo, hi, mid;
+
+	if(!f->lines)
+		buildlines(f);
+	lo = 0;
+	hi = f->nlines - 1;
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if(f->lines[mid] <= off)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* Follows expansions out to the invocation written in a file. */
+static uint32
+fileloc(uint32 loc)
 {
-	FILE *f;
-	int line;
-	int c;
-	int i;
-
-	line = 1;
-	f = fopen(p->file, "r");
-	if (!f)
-		return;
-	while(1) {
-		if(p->line == line)
-			break;
-		c = fgetc(f);
-		if(c == EOF)
-			goto cleanup;
-		if(c == '\n')
-			line += 1;
+	Expansion *e;
+
+	while(loc & MACROLOC) {
+		e = vecget(expansions, loc & ~MACROLOC);
+		loc = e->at;
 	}
-	while(1) {
-		c = fgetc(f);
-		if(c == EOF || c == '\n')
-			break;
-		if(c == '\t')
+	return loc;
+}
+
+static void
+printpos(SrcFile *f, int line, int col, uint32 loc)
+{
+	Expansion *e;
+	char      *p, *end;
+	int        i;
+
+	p = f->buf + f->lines[line];
+	end = f->buf + f->len;
+	while(p != end && *p != '\n') {
+		if(*p == '\t')
 		    fputs("    ", stderr);
 		else
-		    fputc(c, stderr);
+		    fputc(*p, stderr);
+		p++;
 	}
 	fputc('\n', stderr);
-	for(i = 0; i < p->col-1; i++)
+	for(i = 0; i < col-1; i++)
 		fputc(' ', stderr);
 	fputs("^\n", stderr);
-	cleanup:
-	fclose(f);
+	while(loc & MACROLOC) {
+		e = vecget(expansions, loc & ~MACROLOC);
+		fprintf(stderr, "in expansion of macro %s\n", e->macro->name);
+		loc = e->at;
+	}
 }
 
 void
@@ -54,12 +182,34 @@ errorf(char *fmt, ...)
 void
 errorposf(SrcPos *p, char *fmt, ...)
 {
-	va_list va;
+	SrcFile *f;
+	va_list  va;
+	uint32   loc;
+	char    *s, *e;
+	int      off, line, col;
 
 	va_start(va, fmt);
 	vfprintf(stderr, fmt, va);
 	va_end(va);
-	fprintf(stderr, " at %s:%d:%d\n", p->file, p->line, p->col);
-	printpos(p);
+	loc = fileloc(p->loc);
+	f = findfile(loc);
+	if(!f) {
+		fputc('\n', stderr);
+		exit(1);
+	}
+	off = loc - f->base;
+	line = findline(f, off);
+	col = 1;
+	s = f->buf + f->lines[line];
+	e = f->buf + off;
+	while(s != e) {
+		if(*s == '\t')
+			col += 4;
+		else
+			col += 1;
+		s++;
+	}
+	fprintf(stderr, " at %s:%d:%d\n", f->path, line + 1, col);
+	printpos(f, line, col, p->loc);
 	exit(1);
 }
@@ -0,0 +1,300 @@
+#include <u.h>
+#include <mem/mem.h>
+#include <ds/ds.h>
+#include "cc.h"
+
+/* Hidesets are arrays of macro names sorted by Ident sequence
+   number. They are hash-consed, so equal sets are the same
+   pointer and the empty set is null. Union and intersection are
+   merges of the sorted arrays, and their results are memoized. */
+
+struct Hideset {
+	int     seq; /* Creation order, keys the memo table */
+	uint32  h;
+	int     n;
+	Ident **ids;
+};
+
+enum {
+	HSUNION,
+	HSINTERSECT,
+};
+
+typedef struct {
+	Hideset *a;
+	Hideset *b;
+	int      op;
+	Hideset *r;
+} Memo;
+
+static Arena    *hsarena;
+static Hideset **sets;
+static int       nsets;
+static int       setscap;
+static Memo     *memo;
+static int       nmemo;
+static int       memocap;
+static Ident   **scratch;
+static int       scratchcap;
+
+static void
+hsinit(void)
+{
+	hsarena = newarena();
+	setscap = 256;
+	sets = arenaalloc(hsarena, setscap * sizeof(Hideset*));
+	memocap = 256;
+	memo = arenaalloc(hsarena, memocap * sizeof(Memo));
+}
+
+static uint32
+idshash(Ident **ids, int n)
+{
+	uint32 h;
+	int    i;
+
+	/* FNV-1a over the sequence numbers */
+	h = 2166136261u;
+	for(i = 0; i < n; i++)
+		h = (h ^ ids[i]->seq) * 16777619;
+	return h;
+}
+
+static int
+setfind(Ident **ids, int n, uint32 h)
+{
+	Hideset *s;
+	int      i, j;
+
+	i = h & (setscap - 1);
+	for(;;) {
+		s = sets[i];
+		if(!s)
+			return i;
+		if(s->h == h && s->n == n) {
+			for(j = 0; j < n; j++)
+				if(s->ids[j] != ids[j])
+					break;
+			if(j == n)
+				return i;
+		}
+		i = (i + 1) & (setscap - 1);
+	}
+}
+
+static void
+setsgrow(void)
+{
+	Hideset **old;
+	int       i, oldcap;
+
+	old = sets;
+	oldcap = setscap;
+	setscap = oldcap * 2;
+	sets = arenaalloc(hsarena, setscap * sizeof(Hideset*));
+	for(i = 0; i < oldcap; i++)
+		if(old[i])
+			sets[setfind(old[i]->ids, old[i]->n, old[i]->h)] = old[i];
+}
+
+/* Returns the unique hideset holding the n sorted ids,
+   they are only copied if the set is new. */
+static Hideset *
+mkhideset(Ident **ids, int n)
+{
+	Hideset *s;
+	uint32   h;
+	int      i;
+
+	if(n == 0)
+		return 0;
+	if(!hsarena)
+		hsinit();
+	h = idshash(ids, n);
+	i = setfind(ids, n, h);
+	if(sets[i])
+		return sets[i];
+	if((nsets + 1) * 4 > setscap * 3) {
+		setsgrow();
+		i = setfind(ids, n, h);
+	}
+	s = arenaalloc(hsarena, sizeof(Hideset));
+	s->ids = arenaalloc(hsarena, n * sizeof(Ident*));
+	for(i = 0; i < n; i++)
+		s->ids[i] = ids[i];
+	s->n = n;
+	s->h = h;
+	nsets++;
+	s->seq = nsets;
+	sets[setfind(ids, n, h)] = s;
+	return s;
+}
+
+static Memo *
+memofind(Hideset *a, Hideset *b, int op)
+{
+	Memo  *e;
+	uint32 h;
+	int    i;
+
+	h = a->seq;
+	h = (h * 16777619) ^ b->seq;
+	h = (h * 16777619) ^ op;
+	h = h * 16777619;
+	i = h & (memocap - 1);
+	for(;;) {
+		e = &memo[i];
+		if(!e->a)
+			return e;
+		if(e->a == a && e->b == b && e->op == op)
+			return e;
+		i = (i + 1) & (memocap - 1);
+	}
+}
+
+static void
+memogrow(void)
+{
+	Memo *old, *e;
+	int   i, oldcap;
+
+	old = memo;
+	oldcap = memocap;
+	memocap = oldcap * 2;
+	memo = arenaalloc(hsarena, memocap * sizeof(Memo));
+	for(i = 0; i < oldcap; i++) {
+		if(!old[i].a)
+			continue;
+		e = memofind(old[i].a, old[i].b, old[i].op);
+		*e = old[i];
+	}
+}
+
+static Hideset *
+merge(Hideset *a, Hideset *b, int op)
+{
+	Ident *x, *y;
+	int    i, j, n;
+
+	if(a->n + b->n > scratchcap) {
+		scratchcap = (a->n + b->n) * 2;
+		scratch = arenaalloc(hsarena, scratchcap * sizeof(Ident*));
+	}
+	i = 0;
+	j = 0;
+	n = 0;
+	while(i < a->n && j < b->n) {
+		x = a->ids[i];
+		y = b->ids[j];
+		if(x == y) {
+			scratch[n] = x;
+			n++;
+			i++;
+			j++;
+		} else if(x->seq < y->seq) {
+			if(op == HSUNION) {
+				scratch[n] = x;
+				n++;
+			}
+			i++;
+		} else {
+			if(op == HSUNION) {
+				scratch[n] = y;
+				n++;
+			}
+			j++;
+		}
+	}
+	if(op == HSUNION) {
+		for(; i < a->n; i++) {
+			scratch[n] = a->ids[i];
+			n++;
+		}
+		for(; j < b->n; j++) {
+			scratch[n] = b->ids[j];
+			n++;
+		}
+	}
+	return mkhideset(scratch, n);
+}
+
+/* Both operations are commutative, so the operands are
+   ordered to share one memo entry. */
+static Hideset *
+binop(Hideset *a, Hideset *b, int op)
+{
+	Hideset *t;
+	Memo    *e;
+
+	if(a->seq > b->seq) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	e = memofind(a, b, op);
+	if(e->a)
+		return e->r;
+	t = merge(a, b, op);
+	if((nmemo + 1) * 4 > memocap * 3) {
+		memogrow();
+		e = memofind(a, b, op);
+	}
+	e->a = a;
+	e->b = b;
+	e->op = op;
+	e->r = t;
+	nmemo++;
+	return t;
+}
+
+int
+hshas(Hideset *hs, Ident *id)
+{
+	int lo, hi, mid;
+
+	if(!hs)
+		return 0;
+	lo = 0;
+	hi = hs->n - 1;
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(hs->ids[mid] == id)
+			return 1;
+		if(hs->ids[mid]->seq < id->seq)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return 0;
+}
+
+Hideset *
+hsunion(Hideset *a, Hideset *b)
+{
+	if(!a)
+		return b;
+	if(!b || a == b)
+		return a;
+	return binop(a, b, HSUNION);
+}
+
+Hideset *
+hsintersect(Hideset *a, Hideset *b)
+{
+	if(!a || !b)
+		return 0;
+	if(a == b)
+		return a;
+	return binop(a, b, HSINTERSECT);
+}
+
+Hideset *
+hsadd(Hideset *hs, Ident *id)
+{
+	Ident *one[1];
+
+	if(hshas(hs, id))
+		return hs;
+	one[0] = id;
+	return hsunion(hs, mkhideset(one, 1));
+}
@@ -0,0 +1,35 @@
+#include <u.h>
+#include <mem/mem.h>
+#include <ds/ds.h>
+#include "cc.h"
+
+/* Interned spellings live for the whole translation unit,
+   whatever arena the caller happens to be using. */
+static Arena *internarena;
+static Map   *idents;
+static int    nidents;
+
+Ident *
+intern(char *s)
+{
+	Ident *id;
+	Arena *prev;
+
+	if(!internarena) {
+		internarena = newarena();
+		prev = setarena(internarena);
+		idents = map();
+		setarena(prev);
+	}
+	id = mapget(idents, s);
+	if(id)
+		return id;
+	prev = setarena(internarena);
+	id = xmalloc(sizeof(Ident));
+	id->name = xstrdup(s);
+	nidents++;
+	id->seq = nidents;
+	mapset(idents, id->name, id);
+	setarena(prev);
+	return id;
+}
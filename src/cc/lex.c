@@ -107,16 +107,21 @@ enum {
 	INCLUDEHEADER,
 };
 
-/* makes a token, copies v */
+/* Tokens live until the end of the translation
+   unit in an arena of their own. */
+static Arena *tokarena;
+static Ident *includeid;
+
+/* makes a token, interns v */
 static Tok *
 mktok(Lexer *l, int kind) {
 	Tok *r;
+	int  c;
 
-	l->tokval[l->nchars] = 0;
-	r = xmalloc(sizeof(Tok));
-	r->pos.line = l->markpos.line;
-	r->pos.col = l->markpos.col;
-	r->pos.file = l->markpos.file;
+	if(!tokarena)
+		tokarena = newarena();
+	r = arenaalloc(tokarena, sizeof(Tok));
+	r->pos.loc = l->base + ((int64)l->tokstart - (int64)l->buf);
 	r->k = kind;
 	r->ws = l->ws;
 	r->nl = l->nl;
@@ -128,8 +133,13 @@ mktok(Lexer *l, int kind) {
 	case TOKIDENT:
 	case TOKCHARLIT:
 	case TOKHEADER:
-		/* TODO: intern strings */
-		r->v = xstrdup(l->tokval);
+		/* Terminate the token in place for the lookup,
+		   the buffer always has a spare byte at the end. */
+		c = l->tokstart[l->nchars];
+		l->tokstart[l->nchars] = 0;
+		r->id = intern(l->tokstart);
+		l->tokstart[l->nchars] = c;
+		r->v = r->id->name;
 		break;
 	default:
 		r->v = tokktostr(kind);
@@ -144,7 +154,9 @@ mktok(Lexer *l, int kind) {
 			l->includestate = INCLUDEBEGIN;
 		break;
 	case INCLUDEIDENT:
-		if(kind == TOKIDENT && strcmp(r->v, "include") == 0)
+		if(!includeid)
+			includeid = intern("include");
+		if(kind == TOKIDENT && r->id == includeid)
 			l->includestate = INCLUDEHEADER;
 		else
 			l->includestate = INCLUDEBEGIN;
@@ -204,42 +216,34 @@ static void
 mark(Lexer *l)
 {
 	l->nchars = 0;
-	l->markpos.line = l->pos.line;
-	l->markpos.col = l->pos.col;
+	l->tokstart = l->p;
 }
 
+/* Accepted characters are always the ones just read,
+   so the token is the span starting at tokstart. */
 static void 
 accept(Lexer *l, int c)
 {
-	l->tokval[l->nchars] = c;
 	l->nchars += 1;
-	if(l->nchars > MAXTOKSZ)
-		errorposf(&l->markpos, "token too large");
 }
 
 static int 
 nextc(Lexer *l)
 {
 	int c;
-	l->prevpos.col = l->pos.col;
-	l->prevpos.line = l->pos.line;
-	c = fgetc(l->f);
-	if(c == '\n') {
-		l->pos.line += 1;
-		l->pos.col = 1;
-	} else if(c == '\t')
-		l->pos.col += 4;
-	else 
-		l->pos.col += 1;
+
+	if(l->p == l->end)
+		return EOF;
+	c = *l->p & 255;
+	l->p++;
 	return c;
 }
 
 static void
 ungetch(Lexer *l, int c) /* avoid name conflict */
 {
-	l->pos.col = l->prevpos.col;
-	l->pos.line = l->prevpos.line;
-	ungetc(c, l->f);
+	if(c != EOF)
+		l->p--;
 }
 
 Tok *
@@ -327,7 +331,7 @@ lex(Lexer *l)
 	} else if(numberc(c)) {
 		accept(l, c);
 		c2 = nextc(l);
-		if(c == '0' && c2 == 'x') {
+		if(c == '0' && (c2 == 'x' || c2 == 'X')) {
 			accept(l, c);
 			for(;;) {
 				c = nextc(l);
@@ -433,3 +437,89 @@ lex(Lexer *l)
 		panic("internal error\n");
 	}
 }
+
+static int
+dirnameis(char *s, int n, char *name)
+{
+	return strncmp(s, name, n) == 0 && name[n] == 0;
+}
+
+/* Skips an excluded conditional group straight off the buffer
+   without making any tokens. Only comments, quotes and the
+   directive names at line starts are looked at, nested #if
+   groups are counted and skipped whole. Stops in front of the
+   #elif, #else or #endif ending the group, or at end of file. */
+void
+skipgroup(Lexer *l)
+{
+	char *p, *hash, *name;
+	int   c, q, n, bol, depth;
+
+	p = l->p;
+	bol = 1;
+	depth = 0;
+	while(p != l->end) {
+		c = *p;
+		if(c == '\n') {
+			p++;
+			bol = 1;
+		} else if(c == ' ' || c == '\t' || c == '\r') {
+			p++;
+		} else if(c == '\\' && p[1] == '\n') {
+			p = p + 2;
+		} else if(c == '/' && p[1] == '*') {
+			p = p + 2;
+			while(p != l->end && !(p[0] == '*' && p[1] == '/'))
+				p++;
+			if(p != l->end)
+				p = p + 2;
+		} else if(c == '/' && p[1] == '/') {
+			while(p != l->end && *p != '\n')
+				p++;
+		} else if(c == '"' || c == '\'') {
+			/* An unmatched quote, like an apostrophe in
+			   #error text, only runs to the end of the line. */
+			q = c;
+			bol = 0;
+			p++;
+			while(p != l->end && *p != q && *p != '\n') {
+				if(*p == '\\' && p[1] != 0)
+					p++;
+				p++;
+			}
+			if(p != l->end && *p == q)
+				p++;
+		} else if(c == '#' && bol) {
+			hash = p;
+			bol = 0;
+			p++;
+			while(*p == ' ' || *p == '\t')
+				p++;
+			name = p;
+			n = 0;
+			while(identtailc(*p)) {
+				p++;
+				n++;
+			}
+			if(dirnameis(name, n, "if") || dirnameis(name, n, "ifdef") || dirnameis(name, n, "ifndef")) {
+				depth++;
+			} else if(dirnameis(name, n, "endif")) {
+				if(depth == 0)
+					goto stop;
+				depth--;
+			} else if(depth == 0 && (dirnameis(name, n, "elif") || dirnameis(name, n, "else"))) {
+				goto stop;
+			}
+		} else {
+			bol = 0;
+			p++;
+		}
+	}
+	l->p = p;
+	return;
+stop:
+	/* lex() will see the '#' at a line start and begin the directive. */
+	l->p = hash;
+	l->indirective = 0;
+	l->nl = 1;
+}
@@ -60,10 +60,25 @@ static int    isassignop(Tokkind);
 Tok *tok;
 Tok *nexttok;
 
+/* Ordinary identifiers and tags each have one table mapping a
+   name to its innermost Binding, which chains to the bindings it
+   shadows. Every define goes on an undo log, so leaving a scope
+   only touches the names the scope declared. */
+typedef struct Binding Binding;
+struct Binding {
+	char    *name;
+	void    *v;
+	int      depth;  /* The scope it was made in */
+	Map     *tab;
+	Binding *shadow; /* The binding it hides, or 0 */
+};
+
 #define MAXSCOPES 1024
-static int nscopes;
-static Map *tags[MAXSCOPES];
-static Map *syms[MAXSCOPES];
+static int  nscopes;
+static Map *tags;
+static Map *syms;
+static Vec *undolog;
+static int  scopemark[MAXSCOPES];
 
 #define MAXLABELDEPTH 2048
 static int   switchdepth;
@@ -73,6 +88,14 @@ static char *breaks[MAXLABELDEPTH];
 static char *conts[MAXLABELDEPTH];
 static Node *switches[MAXLABELDEPTH];
 
+/* AST nodes are kept apart from the rest of the parser state.
+   A function definition is emitted as soon as it is parsed, so
+   its body, locals and labels are all allocated from funcarena
+   and released together once the function has been emitted. */
+static Arena *astarena;
+static Arena *globalarena;
+static Arena *funcarena;
+
 Node *curfunc;
 Map  *labels;
 Vec  *gotos;
@@ -80,6 +103,8 @@ Vec  *tentativesyms;
 
 int labelcount;
 
+static Ident *builtinvastart;
+
 char *
 newlabel(void)
 {
@@ -173,21 +198,28 @@ popbrk(void)
 static void
 popscope(void)
 {
+	Binding *b;
+
 	nscopes -= 1;
 	if(nscopes < 0)
 		errorf("bug: scope underflow\n");
-	syms[nscopes] = 0;
-	tags[nscopes] = 0;
+	while(undolog->len > scopemark[nscopes]) {
+		b = vecget(undolog, undolog->len - 1);
+		undolog->len -= 1;
+		if(b->shadow)
+			mapset(b->tab, b->name, b->shadow);
+		else
+			mapdel(b->tab, b->name);
+	}
 }
 
 static void
 pushscope(void)
 {
-	syms[nscopes] = map();
-	tags[nscopes] = map();
-	nscopes += 1;
-	if(nscopes > MAXSCOPES)
+	if(nscopes == MAXSCOPES)
 		errorf("scope depth exceeded maximum\n");
+	scopemark[nscopes] = undolog->len;
+	nscopes += 1;
 }
 
 static int
@@ -215,62 +247,66 @@ islval(Node *n)
 }
 
 static int
-define(Map *scope[], char *k, void *v)
+define(Map *tab, char *k, void *v)
 {
-	Map *m;
-	
-	m = scope[nscopes - 1];
-	if(mapget(m, k))
+	Binding *b, *shadow;
+
+	shadow = mapget(tab, k);
+	if(shadow && shadow->depth == nscopes)
 		return 0;
-	mapset(m, k, v);
-	return 1; 
+	b = xmalloc(sizeof(Binding));
+	b->name = k;
+	b->v = v;
+	b->depth = nscopes;
+	b->tab = tab;
+	b->shadow = shadow;
+	mapset(tab, k, b);
+	vecappend(undolog, b);
+	return 1;
 }
 
 static void *
-lookup(Map *scope[], char *k)
+lookup(Map *tab, char *k)
 {
-	int   i;
-	void *v;
-	
-	i = nscopes;
-	while(i--) {
-		v = mapget(scope[i], k);
-		if(v)
-			return v;
-	}
-	return 0;
+	Binding *b;
+
+	b = mapget(tab, k);
+	if(!b)
+		return 0;
+	return b->v;
+}
+
+/* Looks k up in the innermost scope only. */
+static void *
+lookupcur(Map *tab, char *k)
+{
+	Binding *b;
+
+	b = mapget(tab, k);
+	if(!b || b->depth != nscopes)
+		return 0;
+	return b->v;
 }
 
-/* TODO: proper efficient set for tentative syms */
+/* Tentative definitions are kept in declaration order. Each sym
+   records its slot, removal leaves a null in the slot so the
+   order of the rest is kept for emission at the end. */
 static void
 removetentativesym(Sym *sym)
 {
-	int i;
-	Vec *newv;
-	Sym *s;
-
-	newv = vec();
-	for(i = 0; i < tentativesyms->len; i++) {
-		s = vecget(tentativesyms, i);
-		if(s == sym)
-			continue;
-		vecappend(newv, s);
-	}
-	tentativesyms = newv;
+	if(!sym->Global.tentative)
+		return;
+	vecset(tentativesyms, sym->Global.tentative - 1, 0);
+	sym->Global.tentative = 0;
 }
 
 static void
 addtentativesym(Sym *sym)
 {
-	int i;
-	Sym *s;
-
-	for(i = 0; i < tentativesyms->len; i++) {
-		s = vecget(tentativesyms, i);
-		if(s == sym)
-			return;
-	}
+	if(sym->Global.tentative)
+		return;
 	vecappend(tentativesyms, sym);
+	sym->Global.tentative = tentativesyms->len;
 }
 
 
@@ -300,7 +336,7 @@ definesym(SrcPos *p, int sclass, char *name, CTy *type, Node *n)
 			errorposf(p, "cannot use incomplete type in this context");
 	if(sclass == SCAUTO && isglobal())
 		errorposf(p, "defining local symbol in global scope");
-	sym = mapget(syms[nscopes - 1], name);
+	sym = lookupcur(syms, name);
 	if(sym) {
 		switch(sym->k) {
 		case SYMTYPE:
@@ -363,32 +399,26 @@ definesym(SrcPos *p, int sclass, char *name, CTy *type, Node *n)
 			emitsym(sym);
 		else if(sym->Global.sclass == SCEXTERN)
 			emitsym(sym);
-		else
-			if(!isfunc(sym->type))
+		else if(!isfunc(sym->type)) {
+			/* A block scope static is a definition, and is
+			   emitted while its function's arena is alive. */
+			if(isglobal())
 				addtentativesym(sym);
+			else
+				emitsym(sym);
+		}
 	}
 	if(!define(syms, name, sym))
 		panic("internal error");
 	return sym;
 }
 
-static NameTy *
-newnamety(char *n, CTy *t)
-{
-	NameTy *nt;
-	
-	nt = xmalloc(sizeof(NameTy));
-	nt->name = n;
-	nt->type = t;
-	return nt;
-}
-
 static Node *
 mknode(int type, SrcPos *p)
 {
 	Node *n;
 
-	n = xmalloc(sizeof(Node));
+	n = arenaalloc(astarena, sizeof(Node));
 	n->pos = *p;
 	n->t = type;
 	return n;
@@ -630,6 +660,13 @@ parse()
 	brkdepth = 0;
 	contdepth = 0;
 	nscopes = 0;
+	syms = map();
+	tags = map();
+	undolog = vec();
+	astarena = newarena();
+	globalarena = astarena;
+	funcarena = newarena();
+	builtinvastart = intern("__builtin_va_start");
 	tentativesyms = vec();
 	pushscope();
 	next();
@@ -638,7 +675,8 @@ parse()
 		decl();
 	for(i = 0; i < tentativesyms->len; i++) {
 		sym = vecget(tentativesyms, i);
-		emitsym(sym);
+		if(sym)
+			emitsym(sym);
 	}
 }
 
@@ -716,10 +754,14 @@ decl()
 			curfunc = mknode(NFUNC, pos);
 			curfunc->type = type;
 			curfunc->Func.name = name;
-			curfunc->Func.params = vec();
-			curfunc->Func.stkslots = vec();
 			fbody();
 			definesym(pos, sclass, name, type, curfunc);
+			/* The function node stays as a record that
+			   the function has a body. */
+			curfunc->Func.params = 0;
+			curfunc->Func.stkslots = 0;
+			curfunc->Func.body = 0;
+			freearena(funcarena);
 			curfunc = 0;
 			goto done;
 		}
@@ -743,7 +785,12 @@ fbody(void)
 	char   *l;
 	NameTy *nt;
 	Sym    *sym;
+	Arena  *prev;
 
+	prev = setarena(funcarena);
+	astarena = funcarena;
+	curfunc->Func.params = vec();
+	curfunc->Func.stkslots = vec();
 	pushscope();
 	labels = map();
 	gotos = vec();
@@ -766,6 +813,8 @@ fbody(void)
 			errorposf(&gotofixup->pos, "goto target does not exist");
 		gotofixup->Goto.l = l;
 	}
+	astarena = globalarena;
+	setarena(prev);
 }
 
 static int
@@ -1026,8 +1075,7 @@ directdeclarator(CTy *basety, char **name)
 	switch(tok->k) {
 	case '(':
 		expect('(');
-		stub = xmalloc(sizeof(CTy));
-		*stub = *basety;
+		stub = copytype(basety);
 		ty = declarator(stub, name, 0);
 		expect(')');
 		*stub = *declaratortail(basety);
@@ -1073,18 +1121,17 @@ declaratortail(CTy *basety)
 			}
 			newt->align = newt->Arr.subty->align;
 			expect(']');
-			t = newt;
+			t = canontype(newt);
 			break;
 		case '(':
 			newt = newtype(CFUNC);
 			newt->Func.rtype = basety;
-			newt->Func.params = vec();
 			next();
 			params(newt);
 			if(tok->k != ')')
 				errorposf(&tok->pos, "expected valid parameter or )");
 			next();
-			t = newt;
+			t = canontype(newt);
 			break;
 		default:
 			return t;
@@ -1152,7 +1199,7 @@ ptag()
 			default:
 				panic("unreachable");
 			}
-			mapset(tags[nscopes - 1], name, namety);
+			define(tags, name, namety);
 		}
 	}
 	if(tok->k == '{' || !name) {
@@ -1176,9 +1223,9 @@ ptag()
 		return bodyty;
 	}
 	if(bodyty) {
-		namety = mapget(tags[nscopes - 1], name);
+		namety = lookupcur(tags, name);
 		if(!namety) {
-			mapset(tags[nscopes - 1], name, bodyty);
+			define(tags, name, bodyty);
 			return bodyty;
 		}
 		if(!namety->incomplete)
@@ -1201,8 +1248,6 @@ pstruct(int isunion)
 	strct = newtype(CSTRUCT);
 	strct->align = 1; /* XXX zero sized structs? */
 	strct->Struct.isunion = isunion;
-	strct->Struct.exports = vec();
-	strct->Struct.members = vec();
 	
 	startpos = &tok->pos;
 	expect('{');
@@ -1244,7 +1289,6 @@ penum()
 	/* TODO: backend specific? */
 	t->size = 4;
 	t->align = 4;
-	t->Enum.members = vec();
 	expect('{');
 	for(;;) {
 		if(tok->k == '}')
@@ -1623,7 +1667,7 @@ declarrayinit(CTy *t)
 				vecappend(n->Init.inits, initmemb);
 			}
 		} else {
-			initmemb = xmalloc(sizeof(InitMember));
+			initmemb = arenaalloc(astarena, sizeof(InitMember));
 			initmemb->offset = subty->size * idx;
 			initmemb->n = subinit;
 			vecappend(n->Init.inits, initmemb);
@@ -1697,7 +1741,7 @@ declstructinit(CTy *t)
 				vecappend(n->Init.inits, initmemb);
 			}
 		} else {
-			initmemb = xmalloc(sizeof(InitMember));
+			initmemb = arenaalloc(astarena, sizeof(InitMember));
 			initmemb->offset = offset;
 			initmemb->n = subinit;
 			vecappend(n->Init.inits, initmemb);
@@ -1715,11 +1759,17 @@ declstructinit(CTy *t)
 static Node *
 declinit(CTy *t)
 {
+	Node *n;
+
 	if(isarray(t) && tok->k == '{') 
 		return declarrayinit(t);
 	if(isstruct(t)  && tok->k == '{') 
 		return declstructinit(t);
-	return assignexpr();
+	n = assignexpr();
+	/* Data is laid out by the type of its initializer. */
+	if(isitype(t) && isitype(n->type))
+		n = mkcast(&n->pos, n, t);
+	return n;
 }
 
 static Node *
@@ -1813,7 +1863,9 @@ pcase(void)
 	SrcPos *pos;
 	Node   *n;
 	Node   *s;
+	Node   *prev;
 	Const  *c;
+	int     i;
 
 	pos = &tok->pos;
 	s = curswitch();
@@ -1822,6 +1874,11 @@ pcase(void)
 	c = constexpr();
 	if(c->p)
 		errorposf(pos, "case cannot have pointer derived constant");
+	for(i = 0; i < s->Switch.cases->len; i++) {
+		prev = vecget(s->Switch.cases, i);
+		if(prev->Case.cond == c->v)
+			errorposf(pos, "duplicate case value");
+	}
 	n->Case.cond = c->v;
 	expect(':');
 	n->Case.l = newlabel();
@@ -2299,7 +2356,7 @@ primaryexpr(void)
 	
 	switch (tok->k) {
 	case TOKIDENT:
-		if(strcmp(tok->v, "__builtin_va_start") == 0)
+		if(tok->id == builtinvastart)
 			return vastart();
 		sym = lookup(syms, tok->v);
 		if(!sym)
@@ -2311,7 +2368,7 @@ primaryexpr(void)
 		return n;
 	case TOKNUM:
 		n = mknode(NNUM, &tok->pos);
-		n->Num.v = atoll(tok->v);
+		n->Num.v = strtoll(tok->v, 0, 0);
 		n->type = cint;
 		next();
 		return n;
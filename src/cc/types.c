@@ -11,26 +11,230 @@ align(int v, int a)
 	return v;
 }
 
+/* Types live for the whole translation unit, and so does
+   everything hanging off them, even when the type is built
+   while the parser allocates from a function's arena. */
+static Arena *typearena;
+
 CTy *
 newtype(int type)
 {
-	CTy *t;
+	CTy   *t;
+	Arena *prev;
 
-	t = xmalloc(sizeof(CTy));
+	if(!typearena)
+		typearena = newarena();
+	t = arenaalloc(typearena, sizeof(CTy));
 	t->t = type;
+	prev = setarena(typearena);
+	switch(type) {
+	case CFUNC:
+		t->Func.params = vec();
+		break;
+	case CSTRUCT:
+		t->Struct.members = vec();
+		t->Struct.exports = vec();
+		break;
+	case CENUM:
+		t->Enum.members = vec();
+		break;
+	}
+	setarena(prev);
 	return t;
 }
 
+/* A copy of t made in the type arena. The declarator builds types
+   on a placeholder, which must live as long as those types do. */
 CTy *
-mkptr(CTy *t)
+copytype(CTy *t)
 {
-	CTy *p;
+	CTy *c;
 
-	p = newtype(CPTR);
-	p->Ptr.subty = t;
-	p->size = 8;
-	p->align = 8;
-	return p;
+	if(!typearena)
+		typearena = newarena();
+	c = arenaalloc(typearena, sizeof(CTy));
+	*c = *t;
+	return c;
+}
+
+NameTy *
+newnamety(char *n, CTy *t)
+{
+	NameTy *nt;
+
+	if(!typearena)
+		typearena = newarena();
+	nt = arenaalloc(typearena, sizeof(NameTy));
+	nt->name = n;
+	nt->type = t;
+	return nt;
+}
+
+/* Derived types are hash-consed. Building a pointer, sized array or
+   function type out of the same parts gives back the same CTy, so
+   sametype mostly stops at the pointer comparison. Arrays of
+   unknown size are not shared, an initializer may still size them.
+   Function types are keyed by the parameter names as well, since a
+   function definition takes its parameter names from its type. */
+static CTy **typetab;
+static int   ntypes;
+static int   typecap;
+
+static uint32
+mix(uint32 h, int64 v)
+{
+	return (h ^ v) * 16777619;
+}
+
+/* Allocations are 16 byte aligned, the low bits of a pointer
+   say nothing. */
+#define PTRBITS(p) ((int64)(p) >> 4)
+
+static uint32
+typehash(CTy *t)
+{
+	NameTy *nt;
+	uint32  h;
+	int     i;
+
+	h = mix(2166136261u, t->t);
+	switch(t->t) {
+	case CPTR:
+		h = mix(h, PTRBITS(t->Ptr.subty));
+		break;
+	case CARR:
+		h = mix(h, PTRBITS(t->Arr.subty));
+		h = mix(h, t->Arr.dim);
+		break;
+	case CFUNC:
+		h = mix(h, PTRBITS(t->Func.rtype));
+		h = mix(h, t->Func.isvararg);
+		for(i = 0; i < t->Func.params->len; i++) {
+			nt = vecget(t->Func.params, i);
+			h = mix(h, PTRBITS(nt->type));
+			h = mix(h, PTRBITS(nt->name));
+		}
+		break;
+	default:
+		panic("internal error");
+	}
+	return h;
+}
+
+static int
+typeeq(CTy *a, CTy *b)
+{
+	NameTy *an, *bn;
+	int     i;
+
+	if(a->t != b->t)
+		return 0;
+	switch(a->t) {
+	case CPTR:
+		return a->Ptr.subty == b->Ptr.subty;
+	case CARR:
+		return a->Arr.subty == b->Arr.subty && a->Arr.dim == b->Arr.dim;
+	case CFUNC:
+		if(a->Func.rtype != b->Func.rtype)
+			return 0;
+		if(a->Func.isvararg != b->Func.isvararg)
+			return 0;
+		if(a->Func.params->len != b->Func.params->len)
+			return 0;
+		for(i = 0; i < a->Func.params->len; i++) {
+			an = vecget(a->Func.params, i);
+			bn = vecget(b->Func.params, i);
+			if(an->type != bn->type || an->name != bn->name)
+				return 0;
+		}
+		return 1;
+	default:
+		panic("internal error");
+	}
+	return 0;
+}
+
+static int
+typefind(CTy *t, uint32 h)
+{
+	int i;
+
+	i = h & (typecap - 1);
+	while(typetab[i]) {
+		if(typeeq(typetab[i], t))
+			return i;
+		i = (i + 1) & (typecap - 1);
+	}
+	return i;
+}
+
+static void
+typegrow(void)
+{
+	CTy **old;
+	int   i, oldcap;
+
+	old = typetab;
+	oldcap = typecap;
+	if(typecap)
+		typecap = typecap * 2;
+	else
+		typecap = 1024;
+	typetab = arenaalloc(typearena, typecap * sizeof(CTy*));
+	for(i = 0; i < oldcap; i++)
+		if(old[i])
+			typetab[typefind(old[i], typehash(old[i]))] = old[i];
+}
+
+/* Returns the canonical type equal to t. If there is none, t
+   itself becomes canonical, or a copy of it when t is only a
+   lookup key on the stack. */
+static CTy *
+canon(CTy *t, int iskey)
+{
+	CTy   *c;
+	uint32 h;
+	int    i;
+
+	if(!typearena)
+		typearena = newarena();
+	if((ntypes + 1) * 4 > typecap * 3)
+		typegrow();
+	h = typehash(t);
+	i = typefind(t, h);
+	if(typetab[i])
+		return typetab[i];
+	c = t;
+	if(iskey) {
+		c = newtype(t->t);
+		*c = *t;
+	}
+	typetab[i] = c;
+	ntypes++;
+	return c;
+}
+
+/* Returns the canonical version of a freshly built
+   array or function type. */
+CTy *
+canontype(CTy *t)
+{
+	if(t->t == CARR && t->Arr.dim < 0)
+		return t;
+	return canon(t, 0);
+}
+
+CTy *
+mkptr(CTy *t)
+{
+	CTy p;
+
+	memset(&p, 0, sizeof(p));
+	p.t = CPTR;
+	p.Ptr.subty = t;
+	p.size = 8;
+	p.align = 8;
+	return canon(&p, 1);
 }
 
 
@@ -80,6 +284,8 @@ sametype(CTy *l, CTy *r)
 	NameTy *lnt, *rnt;
 	StructMember *lsm, *rsm;
 
+	/* Distinct canonical types can still be compatible, as with
+	   arrays of unknown size or differing parameter names. */
 	if(l == r)
 		return 1;
 	switch(l->t) {
@@ -239,29 +445,33 @@ isarray(CTy *t)
 	return t->t == CARR;
 }
 
+static StructMember *
+structfield(CTy *t, char *name)
+{
+	if(!t->Struct.fields)
+		return 0;
+	return mapget(t->Struct.fields, name);
+}
+
 int
 structoffsetfromname(CTy *t, char *name)
 {
-	int offset;
 	StructMember *sm;
-	StructIter it;
-	
-	if(!getstructiter(&it, t, name))
+
+	sm = structfield(t, name);
+	if(!sm)
 		return -1;
-	structwalk(&it, &sm, &offset);
-	return offset;
+	return sm->offset;
 }
 
 CTy *
 structtypefromname(CTy *t, char *name)
 {
-	int offset;
 	StructMember *sm;
-	StructIter it;
-	
-	if(!getstructiter(&it, t, name))
+
+	sm = structfield(t, name);
+	if(!sm)
 		return 0;
-	structwalk(&it, &sm, &offset);
 	return sm->type;
 }
 
@@ -366,7 +576,7 @@ newstructmember(char *name, int offset, CTy *membt)
 {
 	StructMember *sm;
 
-	sm = xmalloc(sizeof(StructMember));
+	sm = arenaalloc(typearena, sizeof(StructMember));
 	sm->name = name;
 	sm->type = membt;
 	sm->offset = offset;
@@ -382,10 +592,10 @@ addtostruct(CTy *t, char *name, CTy *membt)
 void
 finalizestruct(SrcPos *pos, CTy *t)
 {
-	StructMember *sm;
+	StructMember *sm, *field, *subfield;
 	int i, j, curoffset;
-	StrSet *exportednames;
 	StructExport *export, *subexport;
+	Arena *prev;
 	
 	/* calc alignment */
 	for(i = 0; i < t->Struct.members->len; i++) {
@@ -410,12 +620,14 @@ finalizestruct(SrcPos *pos, CTy *t)
 		}
 		t->size = curoffset;	
 	}
-	/* Calc export fields */
-	exportednames = 0;
+	/* Calc export fields, and the flat field index used for
+	   member access. The index lives as long as the type does. */
+	prev = setarena(typearena);
+	t->Struct.fields = map();
 	for(i = 0; i < t->Struct.members->len; i++) {
 		sm = vecget(t->Struct.members, i);
 		if(sm->name) {
-			if(strsethas(exportednames, sm->name))
+			if(mapget(t->Struct.fields, sm->name))
 				errorposf(pos, "field %s duplicated in struct", sm->name);
 			export = xmalloc(sizeof(StructExport));
 			export->name = sm->name;
@@ -423,14 +635,14 @@ finalizestruct(SrcPos *pos, CTy *t)
 			export->path->idx = i;
 			export->path->next = 0;
 			vecappend(t->Struct.exports, export);
-			exportednames = strsetadd(exportednames, export->name);
+			mapset(t->Struct.fields, sm->name, sm);
 			continue;
 		}
 		if(!isstruct(sm->type))
 			continue;
 		for(j = 0; j < sm->type->Struct.exports->len; j++) {
 			subexport = vecget(sm->type->Struct.exports, j);
-			if(strsethas(exportednames, subexport->name))
+			if(mapget(t->Struct.fields, subexport->name))
 				errorposf(pos, "field %s duplicated in struct", subexport->name);
 			export = xmalloc(sizeof(StructExport));
 			export->name = subexport->name;
@@ -438,9 +650,12 @@ finalizestruct(SrcPos *pos, CTy *t)
 			export->path->idx = i;
 			export->path->next = subexport->path;
 			vecappend(t->Struct.exports, export);
-			exportednames = strsetadd(exportednames, export->name);
+			subfield = structfield(sm->type, subexport->name);
+			field = newstructmember(subexport->name, sm->offset + subfield->offset, subfield->type);
+			mapset(t->Struct.fields, field->name, field);
 		}
 	}
+	setarena(prev);
 	t->size = align(t->size, t->align);
 }
 
@@ -3,9 +3,11 @@
 #include <cc/cc.h>
 #include <mem/mem.h>
 
-static void expr(Node *);
+static void expr(Node *, int);
+static void addr(Node *, int);
+static void flushdata(void);
 static void stmt(Node *);
-static void store(CTy *);
+static void store(CTy *, int, int);
 
 char    *intargregs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 int      stackoffset;
@@ -14,47 +16,287 @@ Vec *pendingdata;
 
 static FILE *o;
 
+/* Pending data is written out after each function, while the
+   string literals and static initializers it points into are
+   still alive. Everything else allocated while emitting a
+   function is scratch and is dropped once the function is done. */
+static Arena *dataarena;
+static Arena *scratch;
+
 void
 emitinit(FILE *out)
 {
 	o = out;
+	dataarena = newarena();
+	scratch = newarena();
 	pendingdata = vec();
 }
 
 void
 penddata(char *label, CTy *ty, Node *init, int isglobal)
 {
-	Data *d;
+	Data  *d;
+	Arena *prev;
 
+	prev = setarena(dataarena);
 	d = xmalloc(sizeof(Data));
 	d->label = label;
 	d->type = ty;
 	d->init = init;
 	d->isglobal = isglobal;
 	vecappend(pendingdata, d);
+	setarena(prev);
 }
 
+/* Assembly is appended to obuf and written out with one fwrite
+   each time it fills. The common instruction shapes have their
+   own appenders that copy strings and never parse a format,
+   out remains for everything else. */
+#define OBUFSZ  (64*1024)
+#define OLINESZ 512 /* Longest line formatted into the buffer */
+
+static char obuf[OBUFSZ];
+static int  olen;
+
 static void
-out(char *fmt, ...)
+oflush(void)
 {
-	va_list va;
-
-	va_start(va, fmt);
-	if(vfprintf(o, fmt, va) < 0)
+	if(olen && (int)fwrite(&obuf[0], 1, olen, o) != olen)
 		errorf("Error printing\n");
-	va_end(va);
+	olen = 0;
+}
+
+static void
+outs(char *s)
+{
+	while(*s) {
+		if(olen == OBUFSZ)
+			oflush();
+		obuf[olen] = *s;
+		olen += 1;
+		s++;
+	}
+}
+
+static void
+outc(int c)
+{
+	if(olen == OBUFSZ)
+		oflush();
+	obuf[olen] = c;
+	olen += 1;
+}
+
+static void
+outnum(int64 v)
+{
+	char buf[24];
+	int  i, neg;
+
+	/* Digits are taken off a negative value so
+	   the most negative number needs no special case. */
+	neg = v < 0;
+	if(!neg)
+		v = -v;
+	i = 0;
+	do {
+		buf[i] = '0' - v % 10;
+		i += 1;
+		v = v / 10;
+	} while(v);
+	if(neg)
+		outc('-');
+	while(i) {
+		i -= 1;
+		outc(buf[i]);
+	}
+}
+
+static void
+outreg(char *r)
+{
+	outc('%');
+	outs(r);
+}
+
+/* off(%base), the offset is left out when it is zero. */
+static void
+outmem(int64 off, char *base)
+{
+	if(off)
+		outnum(off);
+	outc('(');
+	outreg(base);
+	outc(')');
+}
+
+static void
+outop(char *op)
+{
+	outs("  ");
+	outs(op);
+}
+
+static void
+outlabel(char *l)
+{
+	outs(l);
+	outs(":\n");
+}
+
+/* A directive or comment line, directive arg */
+static void
+outdir(char *directive, char *arg)
+{
+	outs(directive);
+	outc(' ');
+	outs(arg);
+	outc('\n');
+}
+
+/* op */
+static void
+ins(char *op)
+{
+	outop(op);
+	outc('\n');
+}
+
+/* op %r */
+static void
+insr(char *op, char *r)
+{
+	outop(op);
+	outc(' ');
+	outreg(r);
+	outc('\n');
+}
+
+/* op %src, %dst */
+static void
+insrr(char *op, char *src, char *dst)
+{
+	outop(op);
+	outc(' ');
+	outreg(src);
+	outs(", ");
+	outreg(dst);
+	outc('\n');
 }
 
+/* op $imm, %dst */
 static void
-outi(char *fmt, ...)
+insir(char *op, int64 imm, char *dst)
+{
+	outop(op);
+	outs(" $");
+	outnum(imm);
+	outs(", ");
+	outreg(dst);
+	outc('\n');
+}
+
+/* op off(%base), %dst */
+static void
+insmr(char *op, int64 off, char *base, char *dst)
+{
+	outop(op);
+	outc(' ');
+	outmem(off, base);
+	outs(", ");
+	outreg(dst);
+	outc('\n');
+}
+
+/* op %src, off(%base) */
+static void
+insrm(char *op, char *src, int64 off, char *base)
+{
+	outop(op);
+	outc(' ');
+	outreg(src);
+	outs(", ");
+	outmem(off, base);
+	outc('\n');
+}
+
+/* op $imm, off(%base) */
+static void
+insim(char *op, int64 imm, int64 off, char *base)
+{
+	outop(op);
+	outs(" $");
+	outnum(imm);
+	outs(", ");
+	outmem(off, base);
+	outc('\n');
+}
+
+/* op off(%base,%index,scale), %dst */
+static void
+insxr(char *op, int64 off, char *base, char *index, int scale, char *dst)
+{
+	outop(op);
+	outc(' ');
+	if(off)
+		outnum(off);
+	outc('(');
+	outreg(base);
+	outs(", ");
+	outreg(index);
+	outs(", ");
+	outnum(scale);
+	outs("), ");
+	outreg(dst);
+	outc('\n');
+}
+
+/* op label */
+static void
+insl(char *op, char *l)
+{
+	outop(op);
+	outc(' ');
+	outs(l);
+	outc('\n');
+}
+
+/* op label(%rip), %dst */
+static void
+insrip(char *op, char *l, char *dst)
+{
+	outop(op);
+	outc(' ');
+	outs(l);
+	outs("(%rip), ");
+	outreg(dst);
+	outc('\n');
+}
+
+static void
+out(char *fmt, ...)
 {
 	va_list va;
+	int     n;
 
+	if(OBUFSZ - olen < OLINESZ)
+		oflush();
 	va_start(va, fmt);
-	fprintf(o, "  ");
-	if(vfprintf(o, fmt, va) < 0)
+	n = vsnprintf(&obuf[olen], OLINESZ, fmt, va);
+	va_end(va);
+	if(n < 0)
 		errorf("Error printing\n");
+	if(n < OLINESZ) {
+		olen += n;
+		return;
+	}
+	/* Too long for the window, write it out directly. */
+	oflush();
+	va_start(va, fmt);
+	n = vfprintf(o, fmt, va);
 	va_end(va);
+	if(n < 0)
+		errorf("Error printing\n");
 }
 
 static void
@@ -78,6 +320,9 @@ calcslotoffsets(Node *f)
 	curoffset = 0;
 	for(i = 0; i < f->Func.stkslots->len; i++) {
 		s = vecget(f->Func.stkslots, i);
+		/* Locals kept in registers need no slot. */
+		if(s->size == 0)
+			continue;
 		tsz = s->size;
 		if(tsz <= 8)
 			tsz = 8;
@@ -97,94 +342,1071 @@ static void
 pushq(char *reg)
 {
 	stackoffset += 8;
-	outi("pushq %%%s\n", reg);
+	insr("pushq", reg);
 }
 
 static void
 popq(char *reg)
 {
 	stackoffset -= 8;
-	outi("popq %%%s\n", reg);
+	insr("popq", reg);
+}
+
+/* Expression temporaries live in a pool of caller saved registers
+   used like a stack: an expression evaluated at index r leaves its
+   value in reg64[r] and may use any register above it. Operands
+   are evaluated in Sethi-Ullman order, the one needing more
+   registers first, and registers are only spilled when an
+   expression needs more than the pool has left. r11 is never in
+   the pool, it is scratch for operators that need fixed registers. */
+#define NPOOL   8
+#define RAX     0
+#define RCX     1
+#define RDX     2
+#define RSI     3
+#define RDI     4
+#define SCRATCH 8
+
+static char *reg64[] = {"rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+static char *reg32[] = {"eax", "ecx", "edx", "esi", "edi", "r8d", "r9d", "r10d", "r11d"};
+static char *reg16[] = {"ax", "cx", "dx", "si", "di", "r8w", "r9w", "r10w", "r11w"};
+static char *reg8[]  = {"al", "cl", "dl", "sil", "dil", "r8b", "r9b", "r10b", "r11b"};
+
+/* Index in the tables above of each integer argument register. */
+static int argregidx[] = {RDI, RSI, RDX, RCX, 5, 6};
+
+/* Operands that need no register of their own: small constants,
+   register locals and 8 byte scalars in memory can be used by an
+   instruction as they are instead of being loaded first. */
+enum {
+	OIMM,
+	OREG,
+	OMEM,
+	ORIP,
+};
+
+typedef struct Opnd Opnd;
+struct Opnd {
+	int    k;
+	int64  v; /* Value of OIMM, offset of OMEM */
+	char  *r; /* Register of OREG, base of OMEM */
+	char  *l; /* Label of ORIP */
+};
+
+static int
+isimm32(int64 v)
+{
+	return v >= -2147483648LL && v <= 2147483647LL;
+}
+
+static int
+opnd(Node *n, Opnd *o)
+{
+	Sym *sym;
+
+	o->k = OIMM;
+	switch(n->t) {
+	case NNUM:
+		o->v = n->Num.v;
+		return isimm32(o->v);
+	case NUNOP:
+		if(n->Unop.op != '-' || n->Unop.operand->t != NNUM)
+			return 0;
+		o->v = -n->Unop.operand->Num.v;
+		return isimm32(o->v);
+	case NSIZEOF:
+		o->v = n->Sizeof.type->size;
+		return 1;
+	case NIDENT:
+		sym = n->Ident.sym;
+		if(sym->k == SYMENUM) {
+			o->v = sym->Enum.v;
+			return isimm32(o->v);
+		}
+		if(!isitype(sym->type) && !isptr(sym->type))
+			return 0;
+		if(sym->k == SYMLOCAL && sym->Local.reg) {
+			o->k = OREG;
+			o->r = sym->Local.reg;
+			return 1;
+		}
+		if(sym->type->size != 8)
+			return 0;
+		if(sym->k == SYMLOCAL) {
+			o->k = OMEM;
+			o->v = sym->Local.slot->offset;
+			o->r = "rbp";
+			return 1;
+		}
+		if(sym->k == SYMGLOBAL) {
+			o->k = ORIP;
+			o->l = sym->Global.label;
+			return 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
 }
 
 static void
-func(Node *f, char *label, int isglobal)
+outopnd(Opnd *o)
 {
-	Vec *v;
+	switch(o->k) {
+	case OIMM:
+		outc('$');
+		outnum(o->v);
+		break;
+	case OREG:
+		outreg(o->r);
+		break;
+	case OMEM:
+		outmem(o->v, o->r);
+		break;
+	case ORIP:
+		outs(o->l);
+		outs("(%rip)");
+		break;
+	}
+}
+
+/* op o, %dst */
+static void
+inso(char *op, Opnd *o, char *dst)
+{
+	outop(op);
+	outc(' ');
+	outopnd(o);
+	outs(", ");
+	outreg(dst);
+	outc('\n');
+}
+
+/* The instruction computing d op o for a binary operator, or 0. */
+static char *
+opndinsn(int op, Opnd *o)
+{
+	switch(op) {
+	case '+':
+		return "addq";
+	case '-':
+		return "subq";
+	case '*':
+		return "imul";
+	case '&':
+		return "and";
+	case '|':
+		return "or";
+	case '^':
+		return "xor";
+	case TOKSHL:
+		if(o->k == OIMM)
+			return "sal";
+		return 0;
+	case TOKSHR:
+		if(o->k == OIMM)
+			return "sar";
+		return 0;
+	case TOKEQL:
+	case TOKNEQ:
+	case TOKGEQ:
+	case TOKLEQ:
+	case '>':
+	case '<':
+		return "cmp";
+	}
+	return 0;
+}
+
+/* The operator with its operands exchanged, or 0. */
+static int
+swapop(int op)
+{
+	switch(op) {
+	case '+':
+	case '*':
+	case '&':
+	case '|':
+	case '^':
+	case TOKEQL:
+	case TOKNEQ:
+		return op;
+	case TOKGEQ:
+		return TOKLEQ;
+	case TOKLEQ:
+		return TOKGEQ;
+	case '>':
+		return '<';
+	case '<':
+		return '>';
+	}
+	return 0;
+}
+
+/* Finds an operand of the binary operator n that can be used in
+   place. *op is set to the operator to apply to the other side,
+   which is returned, and the operand. */
+static Node *
+opndside(Node *n, int *op, Opnd *o)
+{
+	*op = n->Binop.op;
+	if(opnd(n->Binop.r, o))
+	if(opndinsn(*op, o))
+		return n->Binop.l;
+	*op = swapop(n->Binop.op);
+	if(*op)
+	if(opnd(n->Binop.l, o))
+	if(opndinsn(*op, o))
+		return n->Binop.r;
+	return 0;
+}
+
+/* The load that widens a value of type t to 64 bits. */
+static char *
+movext(CTy *t)
+{
+	switch(t->size) {
+	case 8:
+		return "movq";
+	case 4:
+		return "movslq";
+	case 2:
+		return "movswq";
+	case 1:
+		return "movsbq";
+	}
+	panic("internal error\n");
+	return 0;
+}
+
+/* Whether the pointer addition n adds a constant. */
+static int
+immoffset(Node *n)
+{
+	Node *off;
+
+	off = n->Ptradd.offset;
+	if(off->t != NNUM)
+		return 0;
+	return isimm32(off->Num.v * n->type->Ptr.subty->size);
+}
+
+/* Whether the index of n is a constant, which can be folded
+   into the displacement of the element address. */
+static int
+immidx(Node *n)
+{
+	Node *i;
+
+	i = n->Idx.idx;
+	if(i->t != NNUM)
+		return 0;
+	return isimm32(i->Num.v * n->type->size);
+}
+
+static int   need(Node *);
+static char *identreg(Node *);
+
+static int
+su(int l, int r)
+{
+	if(l == r)
+		return l + 1;
+	if(l > r)
+		return l;
+	return r;
+}
+
+static int
+max(int a, int b)
+{
+	if(a > b)
+		return a;
+	return b;
+}
+
+/* Registers needed to compute the address of n. */
+static int
+needaddr(Node *n)
+{
+	switch(n->t) {
+	case NUNOP:
+		return need(n->Unop.operand);
+	case NSEL:
+		return need(n->Sel.operand);
+	case NIDX:
+		if(immidx(n))
+			return need(n->Idx.operand);
+		return su(need(n->Idx.operand), need(n->Idx.idx));
+	default:
+		return 1;
+	}
+}
+
+/* Registers needed to compute the value of n. A call saves the
+   registers in use itself, so it only needs one for its result. */
+static int
+need(Node *n)
+{
+	Node *l;
+	Opnd  o;
+	int   i, r, op;
+
+	if(n->need)
+		return n->need;
+	switch(n->t) {
+	case NUNOP:
+		if(n->Unop.op == '&')
+			r = needaddr(n->Unop.operand);
+		else
+			r = need(n->Unop.operand);
+		break;
+	case NCAST:
+		r = need(n->Cast.operand);
+		break;
+	case NSEL:
+		r = need(n->Sel.operand);
+		break;
+	case NBINOP:
+		if(n->Binop.op == TOKLAND || n->Binop.op == TOKLOR)
+			r = max(need(n->Binop.l), need(n->Binop.r));
+		else if((l = opndside(n, &op, &o)))
+			r = need(l);
+		else
+			r = su(need(n->Binop.l), need(n->Binop.r));
+		break;
+	case NASSIGN:
+		if(identreg(n->Assign.l))
+			r = need(n->Assign.r);
+		else if(n->Assign.op == '=')
+			r = su(need(n->Assign.r), needaddr(n->Assign.l));
+		else
+			r = max(needaddr(n->Assign.l), 2 + need(n->Assign.r));
+		break;
+	case NIDX:
+		if(immidx(n))
+			r = need(n->Idx.operand);
+		else
+			r = su(need(n->Idx.operand), need(n->Idx.idx));
+		break;
+	case NPTRADD:
+		if(immoffset(n))
+			r = need(n->Ptradd.ptr);
+		else
+			r = su(need(n->Ptradd.ptr), need(n->Ptradd.offset));
+		break;
+	case NINCDEC:
+		r = max(needaddr(n->Incdec.operand), 2);
+		if(identreg(n->Incdec.operand))
+			r = 1;
+		break;
+	case NCOND:
+		r = max(need(n->Cond.cond), max(need(n->Cond.iftrue), need(n->Cond.iffalse)));
+		break;
+	case NCOMMA:
+		r = 1;
+		for(i = 0; i < n->Comma.exprs->len; i++)
+			r = max(r, need(vecget(n->Comma.exprs, i)));
+		break;
+	case NBUILTIN:
+		r = 1;
+		if(n->Builtin.t == BUILTIN_VASTART)
+			r = need(n->Builtin.Vastart.valist);
+		break;
+	default:
+		r = 1;
+	}
+	n->need = r;
+	return r;
+}
+
+static void expraddr(Node *, int);
+
+/* Evaluates n into reg64[r] from index 0 with the registers
+   below r saved, when n needs more registers than are left. */
+static int
+spill(Node *n, int isaddr, int r)
+{
+	int i, nr;
+
+	if(isaddr)
+		nr = needaddr(n);
+	else
+		nr = need(n);
+	if(r == 0 || r + nr <= NPOOL)
+		return 0;
+	for(i = 0; i < r; i++)
+		pushq(reg64[i]);
+	if(isaddr)
+		expraddr(n, 0);
+	else
+		expr(n, 0);
+	insrr("movq", "rax", reg64[r]);
+	for(i = r - 1; i >= 0; i--)
+		popq(reg64[i]);
+	return 1;
+}
+
+static void
+eval(Node *n, int isaddr, int r)
+{
+	if(isaddr)
+		addr(n, r);
+	else
+		expr(n, r);
+}
+
+/* Evaluates a into reg64[r] and b into reg64[r+1],
+   whichever needs more registers first. */
+static void
+evaltwo(Node *a, int aaddr, Node *b, int baddr, int r)
+{
+	int na, nb;
+
+	if(aaddr)
+		na = needaddr(a);
+	else
+		na = need(a);
+	if(baddr)
+		nb = needaddr(b);
+	else
+		nb = need(b);
+	if(na >= nb) {
+		eval(a, aaddr, r);
+		eval(b, baddr, r + 1);
+		return;
+	}
+	eval(b, baddr, r);
+	eval(a, aaddr, r + 1);
+	insrr("xchgq", reg64[r], reg64[r + 1]);
+}
+
+/* Scalar locals whose address is never taken are kept in callee
+   saved registers for the whole function. Each gets a live range
+   from its first to its last mention in the order the function is
+   emitted, stretched over any loop it overlaps since its value may
+   be needed on the next iteration. Ranges are then packed into the
+   registers by linear scan, spilling the range that ends last when
+   they run out. A function with gotos is treated as one loop. */
+#define NCALLEE 5
+
+static char *calleeregs[] = {"rbx", "r12", "r13", "r14", "r15"};
+
+typedef struct Range Range;
+struct Range {
 	Sym *sym;
-	int  i;
+	int  start;
+	int  end;
+	int  escapes;
+	int  reg; /* Index into calleeregs, or -1 */
+};
+
+static Vec *ranges;
+static Vec *loops;    /* Ranges standing for loop bodies */
+static int  position;
+static int  hasgoto;
+static int  nsaved;
+static int  saveoff;  /* Frame offset of the first saved register */
+static int  saved[NCALLEE];
+static int  outarea;  /* Largest size of the stack arguments of a call */
+static int  framesz;  /* stackoffset once the frame is set up */
+
+static Range *
+newrange(int start, int end)
+{
+	Range *rg;
+
+	rg = xmalloc(sizeof(Range));
+	rg->start = start;
+	rg->end = end;
+	rg->reg = -1;
+	return rg;
+}
+
+static void
+mention(Sym *sym)
+{
+	Range *rg;
+
+	if(sym->k != SYMLOCAL)
+		return;
+	if(!sym->Local.live) {
+		rg = newrange(position, position);
+		rg->sym = sym;
+		vecappend(ranges, rg);
+		sym->Local.live = ranges->len;
+		return;
+	}
+	rg = vecget(ranges, sym->Local.live - 1);
+	rg->end = position;
+}
+
+static void
+escape(Node *n)
+{
+	Range *rg;
+
+	if(n->t != NIDENT || n->Ident.sym->k != SYMLOCAL)
+		return;
+	mention(n->Ident.sym);
+	rg = vecget(ranges, n->Ident.sym->Local.live - 1);
+	rg->escapes = 1;
+}
+
+static void walk(Node *);
+
+static void
+walkvec(Vec *v)
+{
+	int i;
+
+	for(i = 0; i < v->len; i++)
+		walk(vecget(v, i));
+}
+
+static void
+walkloop(Node *body, Node *a, Node *b, Node *c)
+{
+	Range *loop;
+
+	loop = newrange(position, 0);
+	walk(a);
+	walk(body);
+	walk(b);
+	walk(c);
+	loop->end = position;
+	vecappend(loops, loop);
+}
+
+static void
+walk(Node *n)
+{
+	InitMember *im;
+	Sym        *sym;
+	int         i;
+
+	if(!n)
+		return;
+	position++;
+	switch(n->t) {
+	case NIDENT:
+		mention(n->Ident.sym);
+		break;
+	case NUNOP:
+		if(n->Unop.op == '&')
+			escape(n->Unop.operand);
+		walk(n->Unop.operand);
+		break;
+	case NASSIGN:
+		walk(n->Assign.r);
+		walk(n->Assign.l);
+		break;
+	case NBINOP:
+		walk(n->Binop.l);
+		walk(n->Binop.r);
+		break;
+	case NINCDEC:
+		walk(n->Incdec.operand);
+		break;
+	case NPTRADD:
+		walk(n->Ptradd.ptr);
+		walk(n->Ptradd.offset);
+		break;
+	case NCAST:
+		walk(n->Cast.operand);
+		break;
+	case NSEL:
+		walk(n->Sel.operand);
+		break;
+	case NIDX:
+		walk(n->Idx.operand);
+		walk(n->Idx.idx);
+		break;
+	case NCOND:
+		walk(n->Cond.cond);
+		walk(n->Cond.iftrue);
+		walk(n->Cond.iffalse);
+		break;
+	case NCOMMA:
+		walkvec(n->Comma.exprs);
+		break;
+	case NCALL:
+		if(8 * (n->Call.args->len - 6) > outarea)
+			outarea = 8 * (n->Call.args->len - 6);
+		walkvec(n->Call.args);
+		walk(n->Call.funclike);
+		break;
+	case NINIT:
+		for(i = 0; i < n->Init.inits->len; i++) {
+			im = vecget(n->Init.inits, i);
+			walk(im->n);
+		}
+		break;
+	case NBUILTIN:
+		if(n->Builtin.t == BUILTIN_VASTART) {
+			escape(n->Builtin.Vastart.valist);
+			walk(n->Builtin.Vastart.valist);
+			walk(n->Builtin.Vastart.param);
+		}
+		break;
+	case NDECL:
+		for(i = 0; i < n->Decl.syms->len; i++) {
+			sym = vecget(n->Decl.syms, i);
+			walk(sym->init);
+			mention(sym);
+		}
+		break;
+	case NBLOCK:
+		walkvec(n->Block.stmts);
+		break;
+	case NEXPRSTMT:
+		walk(n->ExprStmt.expr);
+		break;
+	case NRETURN:
+		walk(n->Return.expr);
+		break;
+	case NIF:
+		walk(n->If.expr);
+		walk(n->If.iftrue);
+		walk(n->If.iffalse);
+		break;
+	case NSWITCH:
+		walk(n->Switch.expr);
+		walk(n->Switch.stmt);
+		break;
+	case NCASE:
+		walk(n->Case.stmt);
+		break;
+	case NLABELED:
+		hasgoto = 1;
+		walk(n->Labeled.stmt);
+		break;
+	case NGOTO:
+		hasgoto = 1;
+		break;
+	case NWHILE:
+		walkloop(n->While.stmt, n->While.expr, 0, 0);
+		break;
+	case NDOWHILE:
+		walkloop(n->DoWhile.stmt, n->DoWhile.expr, 0, 0);
+		break;
+	case NFOR:
+		walk(n->For.init);
+		walkloop(n->For.stmt, n->For.cond, n->For.step, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+isregcandidate(Range *rg)
+{
+	CTy *t;
+
+	t = rg->sym->type;
+	if(rg->escapes)
+		return 0;
+	return isitype(t) || isptr(t);
+}
+
+/* Sorts v, a Vec of Ranges, by start or by end. */
+static void
+sortranges(Vec *v, int byend)
+{
+	Range *a, *b;
+	int    i, j, ka, kb;
+
+	for(i = 1; i < v->len; i++) {
+		for(j = i; j > 0; j--) {
+			a = vecget(v, j - 1);
+			b = vecget(v, j);
+			ka = a->start;
+			kb = b->start;
+			if(byend) {
+				ka = a->end;
+				kb = b->end;
+			}
+			if(ka <= kb)
+				break;
+			vecset(v, j - 1, b);
+			vecset(v, j, a);
+		}
+	}
+}
+
+static void
+regalloc(Node *f)
+{
+	Vec   *active;
+	Range *rg, *loop, *last;
+	Sym   *sym;
+	int    i, j, k, used[NCALLEE];
+
+	ranges = vec();
+	loops = vec();
+	position = 0;
+	hasgoto = 0;
+	outarea = 0;
+	for(i = 0; i < f->Func.params->len; i++)
+		mention(vecget(f->Func.params, i));
+	walk(f->Func.body);
+	for(i = 0; i < ranges->len; i++) {
+		rg = vecget(ranges, i);
+		if(hasgoto) {
+			rg->start = 0;
+			rg->end = position;
+		}
+		for(j = 0; j < loops->len; j++) {
+			loop = vecget(loops, j);
+			if(rg->start > loop->end || rg->end < loop->start)
+				continue;
+			if(loop->start < rg->start)
+				rg->start = loop->start;
+			if(loop->end > rg->end)
+				rg->end = loop->end;
+		}
+	}
+	sortranges(ranges, 0);
+	for(k = 0; k < NCALLEE; k++)
+		used[k] = 0;
+	active = vec();
+	for(i = 0; i < ranges->len; i++) {
+		rg = vecget(ranges, i);
+		if(!isregcandidate(rg))
+			continue;
+		/* Free the registers of ranges that have ended. */
+		for(j = 0; j < active->len; j++) {
+			last = vecget(active, j);
+			if(last->end >= rg->start)
+				break;
+		}
+		for(k = 0; j + k < active->len; k++)
+			vecset(active, k, vecget(active, j + k));
+		active->len = k;
+		if(active->len == NCALLEE) {
+			last = vecget(active, active->len - 1);
+			if(last->end <= rg->end)
+				continue;
+			rg->reg = last->reg;
+			last->reg = -1;
+			active->len -= 1;
+		} else {
+			for(k = 0; k < NCALLEE; k++) {
+				for(j = 0; j < active->len; j++) {
+					last = vecget(active, j);
+					if(last->reg == k)
+						break;
+				}
+				if(j == active->len)
+					break;
+			}
+			rg->reg = k;
+		}
+		vecappend(active, rg);
+		sortranges(active, 1);
+	}
+	nsaved = 0;
+	for(i = 0; i < ranges->len; i++) {
+		rg = vecget(ranges, i);
+		sym = rg->sym;
+		sym->Local.reg = 0;
+		if(rg->reg >= 0) {
+			sym->Local.reg = calleeregs[rg->reg];
+			sym->Local.slot->size = 0;
+			used[rg->reg] = 1;
+		}
+	}
+	for(k = 0; k < NCALLEE; k++)
+		if(used[k]) {
+			saved[nsaved] = k;
+			nsaved++;
+		}
+}
+
+/* Restores the callee saved registers and returns. */
+static void
+epilogue(void)
+{
+	int i;
+
+	for(i = 0; i < nsaved; i++)
+		insmr("movq", saveoff - 8 * i, "rbp", calleeregs[saved[i]]);
+	ins("leave");
+	ins("ret");
+}
+
+/* Stores reg64[v] to the register holding a local, narrow
+   values are sign extended as a load from memory would be. */
+static void
+storereg(CTy *t, char *reg, int v)
+{
+	switch(t->size) {
+	case 8:
+		if(strcmp(reg64[v], reg) != 0)
+			insrr("movq", reg64[v], reg);
+		break;
+	case 4:
+		insrr(movext(t), reg32[v], reg);
+		break;
+	case 2:
+		insrr(movext(t), reg16[v], reg);
+		break;
+	case 1:
+		insrr(movext(t), reg8[v], reg);
+		break;
+	default:
+		panic("internal error\n");
+	}
+}
+
+/* The register holding the local n names, or 0. */
+static char *
+identreg(Node *n)
+{
+	if(n->t != NIDENT || n->Ident.sym->k != SYMLOCAL)
+		return 0;
+	return n->Ident.sym->Local.reg;
+}
+
+static void
+func(Node *f, char *label, int isglobal)
+{
+	Vec   *v;
+	Sym   *sym;
+	Arena *prev;
+	int    i;
 	
+	prev = setarena(scratch);
+	regalloc(f);
 	calcslotoffsets(f);
-	out("\n");
-	out(".text\n");
-	out("# function %s\n", f->Func.name);
+	saveoff = -f->Func.localsz - 8;
+	if(f->type->Func.isvararg)
+		saveoff -= 176;
+	/* The callee saved registers are stored below the locals
+	   and the outgoing stack arguments go at the bottom. */
+	f->Func.localsz += 8 * nsaved + outarea;
+	if(f->Func.localsz % 16)
+		f->Func.localsz += 8;
+	outs("\n.text\n# function ");
+	outs(f->Func.name);
+	outc('\n');
 	if(isglobal)
-		out(".globl %s\n", label);
-	out("%s:\n", label);
+		outdir(".globl", label);
+	outlabel(label);
+	stackoffset = 0;
 	pushq("rbp");
-	outi("movq %%rsp, %%rbp\n");
+	insrr("movq", "rsp", "rbp");
 	if(f->type->Func.isvararg) {
 		stackoffset += 176;
-		outi("sub $176, %%rsp\n");
-		outi("movq %%rdi, (%%rsp)\n");
-		outi("movq %%rsi, 8(%%rsp)\n");
-		outi("movq %%rdx, 16(%%rsp)\n");
-		outi("movq %%rcx, 24(%%rsp)\n");
-		outi("movq %%r8, 32(%%rsp)\n");
-		outi("movq %%r9, 40(%%rsp)\n");
+		insir("sub", 176, "rsp");
+		insrm("movq", "rdi", 0, "rsp");
+		insrm("movq", "rsi", 8, "rsp");
+		insrm("movq", "rdx", 16, "rsp");
+		insrm("movq", "rcx", 24, "rsp");
+		insrm("movq", "r8", 32, "rsp");
+		insrm("movq", "r9", 40, "rsp");
 	}
 	if(f->Func.localsz) {
-		outi("sub $%d, %%rsp\n", f->Func.localsz);
+		insir("sub", f->Func.localsz, "rsp");
 		stackoffset += f->Func.localsz;
 	}
+	framesz = stackoffset;
+	for(i = 0; i < nsaved; i++)
+		insrm("movq", calleeregs[saved[i]], saveoff - 8 * i, "rbp");
 	v = f->Func.params;
 	for(i = 0; i < v->len; i++) {
 		sym = vecget(v, i);
 		if(!isitype(sym->type) && !isptr(sym->type) && !isarray(sym->type))
 			errorposf(&f->pos, "unimplemented arg type");
-		if(i < 6) {
-			outi("movq %%%s, %d(%%rbp)\n", intargregs[i], sym->Local.slot->offset);
+		if(sym->Local.reg) {
+			if(i < 6) {
+				storereg(sym->type, sym->Local.reg, argregidx[i]);
+			} else {
+				insmr("movq", 16 + 8 * (i - 6), "rbp", "r11");
+				storereg(sym->type, sym->Local.reg, SCRATCH);
+			}
+		} else if(i < 6) {
+			insrm("movq", intargregs[i], sym->Local.slot->offset, "rbp");
 		} else {
-			outi("movq %d(%%rbp), %%rcx\n", 16 + 8 * (i - 6));
-			outi("leaq %d(%%rbp), %%rax\n", sym->Local.slot->offset);
-			store(sym->type);
+			insmr("movq", 16 + 8 * (i - 6), "rbp", "rcx");
+			insmr("leaq", sym->Local.slot->offset, "rbp", "rax");
+			store(sym->type, RAX, RCX);
 		}
 	}
 	block(f->Func.body);
-	outi("leave\n");
-	outi("ret\n");
+	/* Reaching the end of main returns 0. */
+	if(strcmp(f->Func.name, "main") == 0)
+		insrr("xor", "eax", "eax");
+	epilogue();
+	setarena(prev);
+	freearena(scratch);
+	flushdata();
 }
 
+/* Whether evaluating n may call a function. */
+static int
+hascall(Node *n)
+{
+	int i;
 
+	if(!n)
+		return 0;
+	switch(n->t) {
+	case NCALL:
+		return 1;
+	case NUNOP:
+		return hascall(n->Unop.operand);
+	case NCAST:
+		return hascall(n->Cast.operand);
+	case NSEL:
+		return hascall(n->Sel.operand);
+	case NINCDEC:
+		return hascall(n->Incdec.operand);
+	case NBINOP:
+		if(hascall(n->Binop.l))
+			return 1;
+		return hascall(n->Binop.r);
+	case NASSIGN:
+		if(hascall(n->Assign.l))
+			return 1;
+		return hascall(n->Assign.r);
+	case NIDX:
+		if(hascall(n->Idx.operand))
+			return 1;
+		return hascall(n->Idx.idx);
+	case NPTRADD:
+		if(hascall(n->Ptradd.ptr))
+			return 1;
+		return hascall(n->Ptradd.offset);
+	case NCOND:
+		if(hascall(n->Cond.cond))
+			return 1;
+		if(hascall(n->Cond.iftrue))
+			return 1;
+		return hascall(n->Cond.iffalse);
+	case NCOMMA:
+		for(i = 0; i < n->Comma.exprs->len; i++)
+			if(hascall(vecget(n->Comma.exprs, i)))
+				return 1;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* The label of the function n names, or 0 if it must be called
+   through a pointer. */
+static char *
+calllabel(Node *n)
+{
+	Sym *sym;
+
+	if(n->t != NIDENT)
+		return 0;
+	sym = n->Ident.sym;
+	if(sym->k != SYMGLOBAL || !isfunc(sym->type))
+		return 0;
+	return sym->Global.label;
+}
+
+/* Register arguments in the order of their registers in the pool.
+   An argument evaluated at its register's index only touches the
+   registers above it, so going up the pool leaves the arguments
+   already in place alone. */
+static int argorder[] = {3, 2, 1, 0, 4, 5};
+
+/* The pool is all caller saved, so registers below r are saved
+   around the call. Arguments that cannot call a function are
+   evaluated straight into their registers, those that can are
+   evaluated first and wait on the stack. Stack arguments are
+   stored into the outgoing area at the bottom of the frame when
+   nothing else has been pushed, and into space made for the call
+   otherwise. The stack is kept 16 byte aligned at the call. */
 static void
-call(Node *n)
+call(Node *n, int r)
 {
-	int i, nargs, nintargs, cleanup;
+	int   i, j, nargs, nintargs, pad, cleanup, area, calls, prealloc;
+	char *label;
+	CTy  *fty;
 	Vec  *args;
 	Node *arg;
 
+	for(i = 0; i < r; i++)
+		pushq(reg64[i]);
 	args = n->Call.args;
-	i = nargs = args->len;
-	/* Push args in reverse order */
-	while(i-- != 0) {
+	nargs = args->len;
+	nintargs = nargs;
+	if(nintargs > 6)
+		nintargs = 6;
+	calls = 0;
+	for(i = 0; i < nargs; i++) {
 		arg = vecget(args, i);
 		if(!isitype(arg->type) && !isptr(arg->type) && !isarray(arg->type) && !isfunc(arg->type))
 			errorposf(&arg->pos, "unimplemented arg type\n");
-		expr(arg);
-		pushq("rax");
+		if(hascall(arg))
+			calls = 1;
+	}
+	label = calllabel(n->Call.funclike);
+	area = 8 * (nargs - nintargs);
+	prealloc = !calls && stackoffset == framesz;
+	cleanup = 0;
+	if(!prealloc) {
+		pad = 0;
+		if((stackoffset + area) % 16 != 8)
+			pad = 8;
+		cleanup = area + pad;
+		if(calls)
+			area = 0;
+		if(area + pad) {
+			insir("subq", area + pad, "rsp");
+			stackoffset += area + pad;
+		}
+	}
+	if(calls) {
+		/* Push args in reverse order */
+		i = nargs;
+		while(i-- != 0) {
+			expr(vecget(args, i), 0);
+			pushq("rax");
+		}
+	} else {
+		for(i = 6; i < nargs; i++) {
+			expr(vecget(args, i), 0);
+			insrm("movq", "rax", 8 * (i - 6), "rsp");
+		}
+		for(j = 0; j < 6; j++) {
+			i = argorder[j];
+			if(i < nintargs)
+				expr(vecget(args, i), argregidx[i]);
+		}
+	}
+	if(!label)
+		expr(n->Call.funclike, 7);
+	if(calls)
+		for(i = 0; i < nintargs; i++)
+			popq(intargregs[i]);
+	fty = n->Call.funclike->type;
+	if(isptr(fty))
+		fty = fty->Ptr.subty;
+	/* al holds the number of vector registers used by a variadic call. */
+	if(fty->Func.isvararg)
+		insrr("xor", "eax", "eax");
+	if(label) {
+		insl("call", label);
+	} else {
+		outop("call *");
+		outreg(reg64[7]);
+		outc('\n');
 	}
-	nintargs = nargs;
-	if(nintargs > 6)
-		nintargs = 6;
-	for(i = 0; i < nintargs; i++)
-		popq(intargregs[i]);
-	expr(n->Call.funclike);
-	outi("call *%%rax\n");
-	cleanup = 8 * (nargs - nintargs);
 	if(cleanup) {
-		outi("add $%d, %%rsp\n", cleanup);
+		insir("add", cleanup, "rsp");
 		stackoffset -= cleanup;
 	}
+	if(r)
+		insrr("movq", "rax", reg64[r]);
+	for(i = r - 1; i >= 0; i--)
+		popq(reg64[i]);
 }
 
 static void
@@ -196,34 +1418,19 @@ ereturn(Node *r)
 		ty = r->Return.expr->type;
 		if(!isitype(ty) && !isptr(ty))
 			errorposf(&r->pos, "unimplemented return type");
-		expr(r->Return.expr);
+		expr(r->Return.expr, 0);
 	}
 	/* No need to cleanup with leave */
-	outi("leave\n");
-	outi("ret\n");
+	epilogue();
 }
 
 
+/* Loads the value at the address in reg64[r] into reg64[r]. */
 static void
-load(CTy *t)
+load(CTy *t, int r)
 {
 	if(isitype(t) || isptr(t)) {
-		switch(t->size) {
-		case 8:
-			outi("movq (%%rax), %%rax\n");
-			break;
-		case 4:
-			outi("movslq (%%rax), %%rax\n");
-			break;
-		case 2:
-			outi("movswq (%%rax), %%rax\n");
-			break;
-		case 1:
-			outi("movsbq (%%rax), %%rax\n");
-			break;
-		default:
-			panic("internal error\n");
-		}
+		insmr(movext(t), 0, reg64[r], reg64[r]);
 		return;
 	}
 	if(isstruct(t)) {
@@ -238,22 +1445,24 @@ load(CTy *t)
 	errorf("unimplemented load %d\n", t->t);
 }
 
+/* Stores reg64[v] to the address in reg64[a], a struct
+   is copied from the address in reg64[v]. */
 static void
-store(CTy *t)
+store(CTy *t, int a, int v)
 {
 	if(isitype(t) || isptr(t)) {
 		switch(t->size) {
 		case 8:
-			outi("movq %%rcx, (%%rax)\n");
+			insrm("movq", reg64[v], 0, reg64[a]);
 			break;
 		case 4:
-			outi("movl %%ecx, (%%rax)\n");
+			insrm("movl", reg32[v], 0, reg64[a]);
 			break;
 		case 2:
-			outi("movw %%cx, (%%rax)\n");
+			insrm("movw", reg16[v], 0, reg64[a]);
 			break;
 		case 1:
-			outi("movb %%cl, (%%rax)\n");
+			insrm("movb", reg8[v], 0, reg64[a]);
 			break;
 		default:
 			panic("internal error\n");
@@ -264,10 +1473,12 @@ store(CTy *t)
 		pushq("rdi");
 		pushq("rsi");
 		pushq("rcx");
-		outi("movq %%rcx, %%rsi\n");
-		outi("movq %%rax, %%rdi\n");
-		outi("movq $%d, %%rcx\n", t->size);
-		outi("rep movsb\n");
+		pushq(reg64[a]);
+		pushq(reg64[v]);
+		popq("rsi");
+		popq("rdi");
+		insir("movq", t->size, "rcx");
+		ins("rep movsb");
 		popq("rcx");
 		popq("rsi");
 		popq("rdi");
@@ -284,23 +1495,90 @@ decl(Node *n)
 
 	for(i = 0; i < n->Decl.syms->len; i++) {
 		sym = vecget(n->Decl.syms, i);
-		emitsym(sym);
+		/* Block scope statics and externs were emitted
+		   by the parser when they were declared. */
+		if(sym->k == SYMLOCAL)
+			emitsym(sym);
+	}
+}
+
+/* Multiplies the index in reg64[r] by sz as far as needed to
+   use it in an address, returning the scale that is left. Sizes
+   other than 1, 2, 4 and 8 are made of a lea for a factor of 3, 5
+   or 9 and a shift, with imul only for what is left. */
+static int
+scaleindex(int r, int64 sz)
+{
+	int k;
+
+	if(sz == 1 || sz == 2 || sz == 4 || sz == 8)
+		return sz;
+	k = 0;
+	while(sz % 2 == 0) {
+		sz = sz / 2;
+		k += 1;
+	}
+	if(sz == 3 || sz == 5 || sz == 9)
+		insxr("leaq", 0, reg64[r], reg64[r], sz - 1, reg64[r]);
+	else
+		insir("imul", sz, reg64[r]);
+	if(k > 3) {
+		insir("sal", k - 3, reg64[r]);
+		k = 3;
+	}
+	switch(k) {
+	case 0:
+		return 1;
+	case 1:
+		return 2;
+	case 2:
+		return 4;
+	}
+	return 8;
+}
+
+/* Works out the address of the element n: reg64[r] is left with
+   the base and *off with a displacement. When the index is not a
+   constant it is left in reg64[r+1] and its scale is returned. */
+static int
+elemaddr(Node *n, int r, int64 *off)
+{
+	int64 sz;
+
+	sz = n->type->size;
+	if(immidx(n)) {
+		expr(n->Idx.operand, r);
+		*off = n->Idx.idx->Num.v * sz;
+		return 0;
 	}
+	evaltwo(n->Idx.operand, 0, n->Idx.idx, 0, r);
+	*off = 0;
+	return scaleindex(r + 1, sz);
 }
 
 static void
-addr(Node *n)
+addr(Node *n, int r)
 {
-	int sz;
-	int offset;
-	Sym *sym;
+	if(identreg(n))
+		panic("internal error - address of register local");
+	if(spill(n, 1, r))
+		return;
+	expraddr(n, r);
+}
+
+static void
+expraddr(Node *n, int r)
+{
+	int64 off;
+	int   offset, scale;
+	Sym  *sym;
 	
 	switch(n->t) {
 	case NUNOP:
-		expr(n->Unop.operand);
+		expr(n->Unop.operand, r);
 		break;
 	case NSEL:
-		expr(n->Sel.operand);
+		expr(n->Sel.operand, r);
 		if(isptr(n->Sel.operand->type))
 			offset = structoffsetfromname(n->Sel.operand->type->Ptr.subty, n->Sel.name);
 		else if(isstruct(n->Sel.operand->type))
@@ -309,79 +1587,140 @@ addr(Node *n)
 			panic("internal error");
 		if(offset < 0)
 			panic("internal error");
-		outi("addq $%d, %%rax\n", offset);
+		insir("addq", offset, reg64[r]);
 		break;
 	case NIDENT:
 		sym = n->Ident.sym;
 		switch(sym->k) {
 		case SYMGLOBAL:
-			outi("leaq %s(%%rip), %%rax\n", sym->Global.label);
+			insrip("leaq", sym->Global.label, reg64[r]);
 			break;
 		case SYMLOCAL:
-			outi("leaq %d(%%rbp), %%rax\n", sym->Local.slot->offset);
+			insmr("leaq", sym->Local.slot->offset, "rbp", reg64[r]);
 			break;
 		default:
 			panic("internal error");
 		}
 		break;
 	case NIDX:
-		expr(n->Idx.idx);
-		sz = n->type->size;
-		if(sz != 1) {
-			outi("imul $%d, %%rax\n", sz);
-		}
-		pushq("rax");
-		expr(n->Idx.operand);
-		popq("rcx");
-		outi("addq %%rcx, %%rax\n");
+		scale = elemaddr(n, r, &off);
+		if(scale)
+			insxr("leaq", off, reg64[r], reg64[r + 1], scale, reg64[r]);
+		else if(off)
+			insir("addq", off, reg64[r]);
 		break;
 	default:
 		errorf("unimplemented addr\n");
 	}
 }
 
+/* Sets reg64[d] to whether the flags show comparison op held. */
+static void
+setcc(int op, int d)
+{
+	char *opc;
+
+	switch(op) {
+	case TOKEQL:
+		opc = "sete";
+		break;
+	case TOKNEQ:
+		opc = "setne";
+		break;
+	case '<':
+		opc = "setl";
+		break;
+	case '>':
+		opc = "setg";
+		break;
+	case TOKGEQ:
+		opc = "setge";
+		break;
+	case TOKLEQ:
+		opc = "setle";
+		break;
+	default:
+		panic("internal error");
+	}
+	insr(opc, reg8[d]);
+	insrr("movzbq", reg8[d], reg64[d]);
+}
+
+/* reg64[d] = reg64[d] op reg64[s], where s is above d or is scratch. */
 static void
-obinop(int op, CTy *t)
+obinop(int op, CTy *t, int d, int s)
 {
-	char *lset;
-	char *lafter;
 	char *opc;
+	int   saverax, saverdx, savercx, res;
 	
 	if(!isitype(t) && !isptr(t))
 		panic("unimplemented binary operator type\n");
 	switch(op) {
 	case '+':
-		outi("addq %%rcx, %%rax\n");
+		insrr("addq", reg64[s], reg64[d]);
 		break;
 	case '-':
-		outi("subq %%rcx, %%rax\n");
+		insrr("subq", reg64[s], reg64[d]);
 		break;
 	case '*':
-		outi("imul %%rcx, %%rax\n");
+		insrr("imul", reg64[s], reg64[d]);
 		break;
 	case '/':
-		outi("cqto\n");
-		outi("idiv %%rcx\n");
-		break;
 	case '%':
-		outi("cqto\n");
-		outi("idiv %%rcx\n");
-		outi("mov %%rdx, %%rax\n");
+		/* idiv divides rdx:rax, the divisor goes to scratch
+		   and rax and rdx are saved if they hold values. */
+		if(s != SCRATCH)
+			insrr("movq", reg64[s], "r11");
+		saverax = d != RAX;
+		saverdx = RDX < d;
+		if(saverax)
+			pushq("rax");
+		if(saverdx)
+			pushq("rdx");
+		if(d != RAX)
+			insrr("movq", reg64[d], "rax");
+		ins("cqto");
+		insr("idiv", "r11");
+		res = RAX;
+		if(op == '%')
+			res = RDX;
+		if(res != d)
+			insrr("movq", reg64[res], reg64[d]);
+		if(saverdx)
+			popq("rdx");
+		if(saverax)
+			popq("rax");
 		break;
 	case '|':
-		outi("or %%rcx, %%rax\n");
+		insrr("or", reg64[s], reg64[d]);
 		break;
 	case '&':
-		outi("and %%rcx, %%rax\n");
+		insrr("and", reg64[s], reg64[d]);
 		break;
 	case '^':
-		outi("xor %%rcx, %%rax\n");
+		insrr("xor", reg64[s], reg64[d]);
 		break;
 	case TOKSHR:
-		outi("sar %%cl, %%rax\n");
-		break;
 	case TOKSHL:
-		outi("sal %%cl, %%rax\n");
+		/* The count has to be in cl. */
+		opc = "sar";
+		if(op == TOKSHL)
+			opc = "sal";
+		if(s == RCX) {
+			insrr(opc, "cl", reg64[d]);
+		} else if(d == RCX) {
+			insrr("xchgq", reg64[s], reg64[d]);
+			insrr(opc, "cl", reg64[s]);
+			insrr("movq", reg64[s], reg64[d]);
+		} else {
+			savercx = RCX < d;
+			if(savercx)
+				pushq("rcx");
+			insrr("movq", reg64[s], "rcx");
+			insrr(opc, "cl", reg64[d]);
+			if(savercx)
+				popq("rcx");
+		}
 		break;
 	case TOKEQL:
 	case TOKNEQ:
@@ -389,35 +1728,8 @@ obinop(int op, CTy *t)
 	case TOKLEQ:
 	case '>':
 	case '<':
-		lset = newlabel();
-		lafter = newlabel();
-		switch(op) {
-		case TOKEQL:
-			opc = "jz";
-			break;
-		case TOKNEQ:
-			opc = "jnz";
-			break;
-		case '<':
-			opc = "jl";
-			break;
-		case '>':
-			opc = "jg";
-			break;
-		case TOKGEQ:
-			opc = "jge";
-			break;
-		case TOKLEQ:
-			opc = "jle";
-			break;
-		}
-		outi("cmp %%rcx, %%rax\n");
-		outi("%s %s\n", opc, lset);
-		outi("movq $0, %%rax\n");
-		outi("jmp %s\n", lafter);
-		out("%s:\n", lset);
-		outi("movq $1, %%rax\n");
-		out("%s:\n", lafter);
+		insrr("cmp", reg64[s], reg64[d]);
+		setcc(op, d);
 		break;
 	default:
 		errorf("unimplemented binop %d\n", op);
@@ -425,120 +1737,244 @@ obinop(int op, CTy *t)
 }
 
 static void
-assign(Node *n)
+assign(Node *n, int r)
 {
-	Node *l, *r;
-	int op;
+	Node *l, *rhs;
+	Opnd  o;
+	char *reg;
+	int   op;
 
 	op = n->Assign.op;
 	l = n->Assign.l;
-	r = n->Assign.r;
+	rhs = n->Assign.r;
+	reg = identreg(l);
+	if(reg)
+	if(op != '=')
+	if(opnd(rhs, &o))
+	if(opndinsn(op, &o)) {
+		insrr("movq", reg, reg64[r]);
+		inso(opndinsn(op, &o), &o, reg64[r]);
+		storereg(l->type, reg, r);
+		if(l->type->size != 8)
+			insrr("movq", reg, reg64[r]);
+		return;
+	}
+	if(reg) {
+		expr(rhs, r);
+		if(op != '=') {
+			insrr("movq", reg64[r], "r11");
+			insrr("movq", reg, reg64[r]);
+			obinop(op, n->type, r, SCRATCH);
+		}
+		storereg(l->type, reg, r);
+		if(l->type->size != 8)
+			insrr("movq", reg, reg64[r]);
+		return;
+	}
 	if(op == '=') {
-		expr(r);
-		pushq("rax");
-		addr(l);
-		popq("rcx");
+		evaltwo(rhs, 0, l, 1, r);
 		if(!isptr(l->type) && !isitype(l->type) && !isstruct(l->type))
 			errorf("unimplemented assign\n");
-		store(l->type);
-		outi("movq %%rcx, %%rax\n");
+		store(l->type, r + 1, r);
 		return;
 	}
-	addr(l);
-	pushq("rax");
-	load(l->type);
-	pushq("rax");
-	expr(r);
-	outi("movq %%rax, %%rcx\n");
-	popq("rax");
+	addr(l, r);
+	insrr("movq", reg64[r], reg64[r + 1]);
+	load(l->type, r + 1);
+	expr(rhs, r + 2);
 	/* XXX this type is not correct for comparison ops works anyway, but should be changed*/
-	obinop(op, n->type);
-	outi("movq %%rax, %%rcx\n");
-	popq("rax");
-	store(l->type);
-	outi("movq %%rcx, %%rax\n");
+	obinop(op, n->type, r + 1, r + 2);
+	store(l->type, r, r + 1);
+	insrr("movq", reg64[r + 1], reg64[r]);
 }
 
-static void
-shortcircuit(Node *n)
+static int
+iscmp(int op)
 {
-	char *t, *f, *e;
+	switch(op) {
+	case TOKEQL:
+	case TOKNEQ:
+	case TOKGEQ:
+	case TOKLEQ:
+	case '>':
+	case '<':
+		return 1;
+	}
+	return 0;
+}
 
-	t = newlabel();
-	f = newlabel();
-	e = newlabel();
+/* The jump taken when op holds, or when it does not. */
+static char *
+jcc(int op, int sense)
+{
+	if(!sense) {
+		switch(op) {
+		case TOKEQL:
+			op = TOKNEQ;
+			break;
+		case TOKNEQ:
+			op = TOKEQL;
+			break;
+		case TOKGEQ:
+			op = '<';
+			break;
+		case TOKLEQ:
+			op = '>';
+			break;
+		case '>':
+			op = TOKLEQ;
+			break;
+		case '<':
+			op = TOKGEQ;
+			break;
+		}
+	}
+	switch(op) {
+	case TOKEQL:
+		return "je";
+	case TOKNEQ:
+		return "jne";
+	case TOKGEQ:
+		return "jge";
+	case TOKLEQ:
+		return "jle";
+	case '>':
+		return "jg";
+	case '<':
+		return "jl";
+	}
+	panic("internal error");
+	return 0;
+}
 
-	expr(n->Binop.l);
-	if(n->Binop.op == TOKLAND) {
-		outi("testq %%rax, %%rax\n");
-		outi("jz %s\n", f);
-	} else if(n->Binop.op == TOKLOR) {
-		outi("testq %%rax, %%rax\n");
-		outi("jnz %s\n", t);
-	} else {
-		panic("internal error");
+/* Jumps to l when the truth of c is sense and falls through
+   otherwise. Comparisons branch on the flags they set and
+   && || ! are followed down to them, so a condition is only
+   turned into a value when it is not one of these. */
+static void
+branch(Node *c, int sense, char *l, int r)
+{
+	Node *x;
+	Opnd  o, xo;
+	char *skip;
+	int   op;
+
+	if(c->t == NUNOP && c->Unop.op == '!') {
+		branch(c->Unop.operand, !sense, l, r);
+		return;
+	}
+	if(c->t == NBINOP && (c->Binop.op == TOKLAND || c->Binop.op == TOKLOR)) {
+		/* Both sides jump to l when that decides it,
+		   otherwise the left side may skip the right. */
+		if((c->Binop.op == TOKLAND) != sense) {
+			branch(c->Binop.l, sense, l, r);
+			branch(c->Binop.r, sense, l, r);
+			return;
+		}
+		skip = newlabel();
+		branch(c->Binop.l, !sense, skip, r);
+		branch(c->Binop.r, sense, l, r);
+		outlabel(skip);
+		return;
 	}
-	expr(n->Binop.r);
-	if(n->Binop.op == TOKLAND) {
-		outi("testq %%rax, %%rax\n");
-		outi("jz %s\n", f);
-		outi("jmp %s\n", t);
-	} else if(n->Binop.op == TOKLOR) {
-		outi("testq %%rax, %%rax\n");
-		outi("jnz %s\n", t);
-		outi("jmp %s\n", f);
+	if(c->t == NBINOP && iscmp(c->Binop.op))
+	if((x = opndside(c, &op, &o))) {
+		/* A constant can be compared with memory or a register
+		   local in place, anything else is loaded first. */
+		if(o.k == OIMM && opnd(x, &xo) && xo.k != OIMM) {
+			outop("cmpq $");
+			outnum(o.v);
+			outs(", ");
+			outopnd(&xo);
+			outc('\n');
+		} else {
+			expr(x, r);
+			inso("cmp", &o, reg64[r]);
+		}
+		insl(jcc(op, sense), l);
+		return;
+	}
+	if(c->t == NBINOP && iscmp(c->Binop.op)) {
+		if(r + need(c) > NPOOL) {
+			expr(c, r);
+		} else {
+			evaltwo(c->Binop.l, 0, c->Binop.r, 0, r);
+			insrr("cmp", reg64[r + 1], reg64[r]);
+			insl(jcc(c->Binop.op, sense), l);
+			return;
+		}
 	} else {
-		panic("internal error");
+		expr(c, r);
 	}
-	out("%s:\n", t);
-	outi("mov $1, %%rax\n");
-	outi("jmp %s\n", e);
-	out("%s:\n", f);
-	outi("xor %%rax, %%rax\n");
-	outi("jmp %s\n", e);
-	out("%s:\n", e);
+	insrr("test", reg64[r], reg64[r]);
+	if(sense)
+		insl("jnz", l);
+	else
+		insl("jz", l);
+}
+
+static void
+shortcircuit(Node *n, int r)
+{
+	char *f, *e;
+
+	f = newlabel();
+	e = newlabel();
+	branch(n, 0, f, r);
+	insir("mov", 1, reg64[r]);
+	insl("jmp", e);
+	outlabel(f);
+	insrr("xor", reg64[r], reg64[r]);
+	outlabel(e);
 }
 
 static void
-binop(Node *n)
+binop(Node *n, int r)
 {
+	Node *l;
+	Opnd  o;
+	int   op;
+
 	if(n->Binop.op == TOKLAND || n->Binop.op == TOKLOR) {
-		shortcircuit(n);
+		shortcircuit(n, r);
+		return;
+	}
+	l = opndside(n, &op, &o);
+	if(l) {
+		expr(l, r);
+		inso(opndinsn(op, &o), &o, reg64[r]);
+		if(iscmp(op))
+			setcc(op, r);
 		return;
 	}
-	expr(n->Binop.l);
-	pushq("rax");
-	expr(n->Binop.r);
-	outi("movq %%rax, %%rcx\n");
-	popq("rax");
-	obinop(n->Binop.op, n->type);
+	evaltwo(n->Binop.l, 0, n->Binop.r, 0, r);
+	obinop(n->Binop.op, n->type, r, r + 1);
 }
 
 static void
-unop(Node *n)
+unop(Node *n, int r)
 {
 	switch(n->Unop.op) {
 	case '*':
-		expr(n->Unop.operand);
-		load(n->type);
+		expr(n->Unop.operand, r);
+		load(n->type, r);
 		break;
 	case '&':
-		addr(n->Unop.operand);
+		addr(n->Unop.operand, r);
 		break;
 	case '~':
-		expr(n->Unop.operand);
-		out("notq %%rax\n");
+		expr(n->Unop.operand, r);
+		insr("notq", reg64[r]);
 		break;
 	case '!':
-		expr(n->Unop.operand);
-		outi("xorq %%rcx, %%rcx\n");
-		outi("testq %%rax, %%rax\n");
-		outi("setz %%cl\n");
-		outi("movq %%rcx, %%rax\n");
+		expr(n->Unop.operand, r);
+		insrr("testq", reg64[r], reg64[r]);
+		insr("setz", reg8[r]);
+		insrr("movzbq", reg8[r], reg64[r]);
 		break;
 	case '-':
-		expr(n->Unop.operand);
-		outi("neg %%rax\n");
+		expr(n->Unop.operand, r);
+		insr("neg", reg64[r]);
 		break;
 	case TOKINC:
 	default:
@@ -546,53 +1982,102 @@ unop(Node *n)
 	}
 }
 
+/* The old value is kept in reg64[r] for a postfix operator
+   while the new one is worked out in scratch. */
+static void
+regincdec(Node *n, int r)
+{
+	char *reg, *v;
+	int   delta;
+
+	reg = identreg(n->Incdec.operand);
+	v = reg64[r];
+	insrr("movq", reg, v);
+	if(n->Incdec.post == 1) {
+		v = "r11";
+		insrr("movq", reg, v);
+	}
+	delta = 1;
+	if(isptr(n->type))
+		delta = n->type->Ptr.subty->size;
+	if(n->Incdec.op != TOKINC)
+		delta = -delta;
+	insir("add", delta, v);
+	if(n->Incdec.post == 1) {
+		storereg(n->type, reg, SCRATCH);
+		return;
+	}
+	storereg(n->type, reg, r);
+	if(n->type->size != 8)
+		insrr("movq", reg, v);
+}
+
 static void
-incdec(Node *n)
+incdec(Node *n, int r)
 {
+	char *v;
+
 	if(!isitype(n->type) && !isptr(n->type))
 		panic("unimplemented incdec");
-	addr(n->Incdec.operand);
-	pushq("rax");
-	load(n->type);
+	if(identreg(n->Incdec.operand)) {
+		regincdec(n, r);
+		return;
+	}
+	addr(n->Incdec.operand, r);
+	v = reg64[r + 1];
+	insrr("movq", reg64[r], v);
+	load(n->type, r + 1);
 	if(isptr(n->type)) {
 		if(n->Incdec.op == TOKINC)
-			outi("add $%d, %%rax\n", n->type->Ptr.subty->size);
+			insir("add", n->type->Ptr.subty->size, v);
 		else
-			outi("add $%d, %%rax\n", -n->type->Ptr.subty->size);
+			insir("add", -n->type->Ptr.subty->size, v);
 	} else {
 		if(n->Incdec.op == TOKINC)
-			outi("inc %%rax\n");
+			insr("inc", v);
 		else
-			outi("dec %%rax\n");
+			insr("dec", v);
 	}
-	outi("movq %%rax, %%rcx\n");
-	popq("rax");
-	store(n->type);
-	outi("movq %%rcx, %%rax\n");
+	store(n->type, r, r + 1);
+	insrr("movq", v, reg64[r]);
 	if(n->Incdec.post == 1) {
 		if(n->Incdec.op == TOKINC)
-			outi("dec %%rax\n");
+			insr("dec", reg64[r]);
 		else
-			outi("inc %%rax\n");
+			insr("inc", reg64[r]);
 	}
 }
 
 static void
-ident(Node *n)
+ident(Node *n, int r)
 {
 	Sym *sym;
 
 	sym = n->Ident.sym;
 	if(sym->k == SYMENUM) {
-		outi("movq $%d, %%rax\n", sym->Enum.v);
+		insir("movq", sym->Enum.v, reg64[r]);
 		return;
 	}
-	addr(n);
+	if(identreg(n)) {
+		insrr("movq", identreg(n), reg64[r]);
+		return;
+	}
+	if(isitype(sym->type) || isptr(sym->type)) {
+		if(sym->k == SYMLOCAL) {
+			insmr(movext(sym->type), sym->Local.slot->offset, "rbp", reg64[r]);
+			return;
+		}
+		if(sym->k == SYMGLOBAL) {
+			insrip(movext(sym->type), sym->Global.label, reg64[r]);
+			return;
+		}
+	}
+	addr(n, r);
 	if(sym->k == SYMLOCAL)
 	if(sym->Local.isparam)
 	if(isarray(sym->type))
-		outi("movq (%%rax), %%rax\n");
-	load(n->type);
+		insmr("movq", 0, reg64[r], reg64[r]);
+	load(n->type, r);
 }
 
 static void
@@ -600,110 +2085,233 @@ eif(Node *n)
 {
 	char *end;
 
-	end = newlabel();
-	expr(n->If.expr);
-	outi("test %%rax, %%rax\n");
-	outi("jz %s\n", n->If.lelse);
+	branch(n->If.expr, 0, n->If.lelse, 0);
 	stmt(n->If.iftrue);
-	outi("jmp %s\n", end);
-	out("%s:\n", n->If.lelse);
-	if(n->If.iffalse)
-		stmt(n->If.iffalse);
-	out("%s:\n", end);
+	if(!n->If.iffalse) {
+		outlabel(n->If.lelse);
+		return;
+	}
+	end = newlabel();
+	insl("jmp", end);
+	outlabel(n->If.lelse);
+	stmt(n->If.iffalse);
+	outlabel(end);
 }
 
 static void
 efor(Node *n)
 {
 	if(n->For.init)
-		expr(n->For.init);
-	out("%s:\n", n->For.lstart);
-	if(n->For.cond) {
-		expr(n->For.cond);
-		outi("test %%rax, %%rax\n");
-		outi("jz %s\n", n->For.lend);
-	}
+		expr(n->For.init, 0);
+	outlabel(n->For.lstart);
+	if(n->For.cond)
+		branch(n->For.cond, 0, n->For.lend, 0);
 	stmt(n->For.stmt);
-	outi("%s:\n", n->For.lstep);
+	outlabel(n->For.lstep);
 	if(n->For.step)
-		expr(n->For.step);
-	outi("jmp %s\n", n->For.lstart);
-	out("%s:\n", n->For.lend);
+		expr(n->For.step, 0);
+	insl("jmp", n->For.lstart);
+	outlabel(n->For.lend);
 }
 
 static void
 ewhile(Node *n)
 {
-	out("%s:\n", n->While.lstart);
-	expr(n->While.expr);
-	outi("test %%rax, %%rax\n");
-	outi("jz %s\n", n->While.lend);
+	outlabel(n->While.lstart);
+	branch(n->While.expr, 0, n->While.lend, 0);
 	stmt(n->While.stmt);
-	outi("jmp %s\n", n->While.lstart);
-	out("%s:\n", n->While.lend);
+	insl("jmp", n->While.lstart);
+	outlabel(n->While.lend);
 }
 
 static void
 dowhile(Node *n)
 {
-	out("%s:\n", n->DoWhile.lstart);
+	outlabel(n->DoWhile.lstart);
 	stmt(n->DoWhile.stmt);
-	out("%s:\n", n->DoWhile.lcond);
-	expr(n->DoWhile.expr);
-	outi("test %%rax, %%rax\n");
-	outi("jz %s\n", n->DoWhile.lend);
-	outi("jmp %s\n", n->DoWhile.lstart);
-	out("%s:\n", n->DoWhile.lend);
+	outlabel(n->DoWhile.lcond);
+	branch(n->DoWhile.expr, 1, n->DoWhile.lstart, 0);
+	outlabel(n->DoWhile.lend);
 }
 
+/* A switch is lowered by sorting its cases and splitting them in
+   half until what is left is either small enough to compare in
+   turn or dense enough for a jump table. A table may have up to
+   SWDENSITY slots per case, the holes jump to the default. */
+#define SWLINEAR  4
+#define SWDENSITY 3
+
+/* Compares the switch value in rax with v. */
 static void
-eswitch(Node *n)
+cmpcase(int64 v)
+{
+	if(isimm32(v)) {
+		insir("cmpq", v, "rax");
+		return;
+	}
+	insir("movq", v, "rcx");
+	insrr("cmpq", "rcx", "rax");
+}
+
+static int64
+caseval(Vec *cases, int i)
 {
-	int   i;
 	Node *c;
 
-	expr(n->Switch.expr);
-	for(i = 0; i < n->Switch.cases->len; i++) {
-		c = vecget(n->Switch.cases, i);
-		outi("mov $%lld, %%rcx\n", c->Case.cond);
-		outi("cmp %%rax, %%rcx\n");
-		outi("je %s\n", c->Case.l);
+	c = vecget(cases, i);
+	return c->Case.cond;
+}
+
+/* The distance from the first to the last of cases[lo..hi), or -1
+   when it does not fit in an int64. It is worked out unsigned so
+   cases at both ends of the range cannot overflow. */
+static int64
+casedist(Vec *cases, int lo, int hi)
+{
+	return (int64)((uint64)caseval(cases, hi - 1) - (uint64)caseval(cases, lo));
+}
+
+static void
+sortcases(Vec *cases)
+{
+	Node *a, *b;
+	int   i, j;
+
+	for(i = 1; i < cases->len; i++) {
+		for(j = i; j > 0; j--) {
+			a = vecget(cases, j - 1);
+			b = vecget(cases, j);
+			if(a->Case.cond <= b->Case.cond)
+				break;
+			vecset(cases, j - 1, b);
+			vecset(cases, j, a);
+		}
 	}
-	if(n->Switch.ldefault) {
-		outi("jmp %s\n", n->Switch.ldefault);
-	} else {
-		outi("jmp %s\n", n->Switch.lend);
+}
+
+/* The table holds offsets from itself so it needs no relocations. */
+static void
+jumptable(Vec *cases, int lo, int hi, char *ldefault)
+{
+	Node  *c;
+	char  *ltab;
+	int64  first, dist, k;
+	int    i;
+
+	first = caseval(cases, lo);
+	dist = casedist(cases, lo, hi);
+	ltab = newlabel();
+	insrr("movq", "rax", "r11");
+	if(first != 0) {
+		if(isimm32(first)) {
+			insir("subq", first, "r11");
+		} else {
+			insir("movq", first, "rcx");
+			insrr("subq", "rcx", "r11");
+		}
+	}
+	insir("cmpq", dist, "r11");
+	insl("ja", ldefault);
+	insrip("leaq", ltab, "rcx");
+	insxr("movslq", 0, "rcx", "r11", 4, "r11");
+	insrr("addq", "rcx", "r11");
+	outop("jmp *");
+	outreg("r11");
+	outc('\n');
+	out(".section .rodata\n.align 4\n");
+	outlabel(ltab);
+	i = lo;
+	for(k = 0; k <= dist; k++) {
+		c = vecget(cases, i);
+		if(c->Case.cond == (int64)((uint64)first + (uint64)k)) {
+			out(".long %s - %s\n", c->Case.l, ltab);
+			i++;
+		} else {
+			out(".long %s - %s\n", ldefault, ltab);
+		}
+	}
+	out(".text\n");
+}
+
+/* Dispatches on cases[lo..hi) which are sorted by value. */
+static void
+switchtree(Vec *cases, int lo, int hi, char *ldefault)
+{
+	Node  *c;
+	char  *lleft;
+	int64  dist;
+	int    i, n, mid;
+
+	n = hi - lo;
+	if(n < SWLINEAR) {
+		for(i = lo; i < hi; i++) {
+			c = vecget(cases, i);
+			cmpcase(c->Case.cond);
+			insl("je", c->Case.l);
+		}
+		insl("jmp", ldefault);
+		return;
+	}
+	dist = casedist(cases, lo, hi);
+	if(dist >= 0 && dist < SWDENSITY * n) {
+		jumptable(cases, lo, hi, ldefault);
+		return;
 	}
+	mid = lo + n / 2;
+	c = vecget(cases, mid);
+	lleft = newlabel();
+	cmpcase(c->Case.cond);
+	insl("je", c->Case.l);
+	insl("jl", lleft);
+	switchtree(cases, mid + 1, hi, ldefault);
+	outlabel(lleft);
+	switchtree(cases, lo, mid, ldefault);
+}
+
+static void
+eswitch(Node *n)
+{
+	Vec  *cases;
+	char *ldefault;
+	int   i;
+
+	expr(n->Switch.expr, 0);
+	cases = vec();
+	for(i = 0; i < n->Switch.cases->len; i++)
+		vecappend(cases, vecget(n->Switch.cases, i));
+	sortcases(cases);
+	ldefault = n->Switch.lend;
+	if(n->Switch.ldefault)
+		ldefault = n->Switch.ldefault;
+	switchtree(cases, 0, cases->len, ldefault);
 	stmt(n->Switch.stmt);
-	out("%s:\n", n->Switch.lend);
+	outlabel(n->Switch.lend);
 }
 
 static void
-cond(Node *n)
+cond(Node *n, int r)
 {
 	char *lfalse, *lend;
 
 	if(!isitype(n->type) && !isptr(n->type))
 		panic("unimplemented emit cond");
-	expr(n->Cond.cond);
 	lfalse = newlabel();
 	lend = newlabel();
-	outi("test %%rax, %%rax\n");
-	outi("jz %s\n", lfalse);
-	expr(n->Cond.iftrue);
-	outi("jmp %s\n", lend);
-	out("%s:\n", lfalse);
-	expr(n->Cond.iffalse);
-	out("%s:\n", lend);
+	branch(n->Cond.cond, 0, lfalse, r);
+	expr(n->Cond.iftrue, r);
+	insl("jmp", lend);
+	outlabel(lfalse);
+	expr(n->Cond.iffalse, r);
+	outlabel(lend);
 }
 
 static void
-cast(Node *n)
+cast(Node *n, int r)
 {
 	CTy *from;
 	CTy *to;
 	
-	expr(n->Cast.operand);
+	expr(n->Cast.operand, r);
 	from = n->Cast.operand->type;
 	to = n->type;
 	if(isptr(from) && isptr(to))
@@ -722,12 +2330,12 @@ cast(Node *n)
 }
 
 static void
-sel(Node *n)
+sel(Node *n, int r)
 {
 	CTy *t;
 	int offset;
 
-	expr(n->Sel.operand);
+	expr(n->Sel.operand, r);
 	t = n->Sel.operand->type;
 	if(isptr(t))
 		offset = structoffsetfromname(t->Ptr.subty, n->Sel.name);
@@ -738,131 +2346,141 @@ sel(Node *n)
 	if(offset < 0)
 		panic("internal error");
 	if(offset != 0)
-		outi("add $%d, %%rax\n", offset);
-	load(n->type);
+		insir("add", offset, reg64[r]);
+	load(n->type, r);
 }
 
 static void
-idx(Node *n)
+idx(Node *n, int r)
 {
-	int sz;
+	int64 off;
+	int   scale;
 
-	expr(n->Idx.idx);
-	sz = n->type->size;
-	if(sz != 1)
-		outi("imul $%d, %%rax\n", sz);
-	outi("push %%rax\n");
-	expr(n->Idx.operand);
-	outi("pop %%rcx\n");
-	outi("addq %%rcx, %%rax\n");
-	load(n->type);
+	scale = elemaddr(n, r, &off);
+	if(isitype(n->type) || isptr(n->type)) {
+		if(scale)
+			insxr(movext(n->type), off, reg64[r], reg64[r + 1], scale, reg64[r]);
+		else
+			insmr(movext(n->type), off, reg64[r], reg64[r]);
+		return;
+	}
+	if(scale)
+		insxr("leaq", off, reg64[r], reg64[r + 1], scale, reg64[r]);
+	else if(off)
+		insir("addq", off, reg64[r]);
+	load(n->type, r);
 }
 
 static void
-ptradd(Node *n)
+ptradd(Node *n, int r)
 {
 	int sz;
 
 	sz = n->type->Ptr.subty->size;
-	expr(n->Ptradd.offset);
-	if(sz != 1)
-		outi("imul $%d, %%rax\n", sz);
-	outi("push %%rax\n");
-	expr(n->Ptradd.ptr);
-	outi("pop %%rcx\n");
-	outi("addq %%rcx, %%rax\n");
+	if(immoffset(n)) {
+		expr(n->Ptradd.ptr, r);
+		if(n->Ptradd.offset->Num.v)
+			insir("addq", n->Ptradd.offset->Num.v * sz, reg64[r]);
+		return;
+	}
+	evaltwo(n->Ptradd.ptr, 0, n->Ptradd.offset, 0, r);
+	insxr("leaq", 0, reg64[r], reg64[r + 1], scaleindex(r + 1, sz), reg64[r]);
 }
 
 static void
-comma(Node *n)
+comma(Node *n, int r)
 {
 	int i;
 
 	for(i = 0; i < n->Comma.exprs->len; i++) {
-		expr(vecget(n->Comma.exprs, i));
+		expr(vecget(n->Comma.exprs, i), r);
 	}
 }
 
 static void
-str(Node *n)
+str(Node *n, int r)
 {
-	char *l;
+	char  *l;
+	Arena *prev;
 
+	prev = setarena(dataarena);
 	l = newlabel();
+	setarena(prev);
 	penddata(l, n->type, n, 0);
-	outi("leaq %s(%%rip), %%rax\n", l);
-	outi("movq (%%rax), %%rax\n", l);
+	insrip("movq", l, reg64[r]);
 }
 
 static void
-vastart(Node *n)
+vastart(Node *n, int r)
 {
 	int argend;
 	
-	expr(n->Builtin.Vastart.valist);
+	expr(n->Builtin.Vastart.valist, r);
 	/* XXX currently only support int args */
 	argend = (n->Builtin.Vastart.param->Ident.sym->Local.paramidx + 1) * 8;
-	pushq("rcx");
-	outi("movl $%d, (%%rax)\n", argend);
-	outi("movl $%d, 4(%%rax)\n", 48 + 0 * 16);
-	outi("leaq %d(%%rbp), %%rcx\n", -176);
-	outi("movq %%rcx, 16(%%rax)\n");
-	popq("rcx");
+	insim("movl", argend, 0, reg64[r]);
+	insim("movl", 48 + 0 * 16, 4, reg64[r]);
+	insmr("leaq", -176, "rbp", "r11");
+	insrm("movq", "r11", 16, reg64[r]);
 }
 
 static void
-expr(Node *n)
+expr(Node *n, int r)
 {
+	if(r >= NPOOL)
+		panic("internal error - register pool exhausted");
+	if(spill(n, 0, r))
+		return;
 	switch(n->t){
 	case NCOMMA:
-		comma(n);
+		comma(n, r);
 		break;
 	case NCAST:
-		cast(n);
+		cast(n, r);
 		break;
 	case NSTR:
-		str(n);
+		str(n, r);
 		break;
 	case NSIZEOF:
-		outi("movq $%lld, %%rax\n", n->Sizeof.type->size);
+		insir("movq", n->Sizeof.type->size, reg64[r]);
 		break;
 	case NNUM:
-		outi("movq $%lld, %%rax\n", n->Num.v);
+		insir("movq", n->Num.v, reg64[r]);
 		break;
 	case NIDENT:
-		ident(n);
+		ident(n, r);
 		break;
 	case NUNOP:
-		unop(n);
+		unop(n, r);
 		break;
 	case NASSIGN:
-		assign(n);
+		assign(n, r);
 		break;
 	case NBINOP:
-		binop(n);
+		binop(n, r);
 		break;
 	case NIDX:
-		idx(n);
+		idx(n, r);
 		break;
 	case NSEL:
-		sel(n);
+		sel(n, r);
 		break;
 	case NCOND:
-		cond(n);
+		cond(n, r);
 		break;
 	case NCALL:
-		call(n);
+		call(n, r);
 		break;
 	case NPTRADD:
-		ptradd(n);
+		ptradd(n, r);
 		break;
 	case NINCDEC:
-		incdec(n);
+		incdec(n, r);
 		break;
 	case NBUILTIN:
 		switch(n->Builtin.t) {
 		case BUILTIN_VASTART:
-			vastart(n);
+			vastart(n, r);
 			break;
 		default:
 			errorposf(&n->pos, "unimplemented builtin");
@@ -903,19 +2521,19 @@ stmt(Node *n)
 		eswitch(n);
 		break;
 	case NGOTO:
-		outi("jmp %s\n", n->Goto.l);
+		insl("jmp", n->Goto.l);
 		break;
 	case NCASE:
-		out("%s:\n", n->Case.l);
+		outlabel(n->Case.l);
 		stmt(n->Case.stmt);
 		break;
 	case NLABELED:
-		out("%s:\n", n->Labeled.l);
+		outlabel(n->Labeled.l);
 		stmt(n->Labeled.stmt);
 		break;
 	case NEXPRSTMT:
 		if(n->ExprStmt.expr)
-			expr(n->ExprStmt.expr);
+			expr(n->ExprStmt.expr, 0);
 		break;
 	default:
 		errorf("unimplemented emit stmt %d\n", n->t);
@@ -977,25 +2595,28 @@ data(Data *d)
 	char *l;
 	
 	if(!d->init) {
+		/* .comm symbols are merged by the linker, statics must stay local. */
+		if(!d->isglobal)
+			outdir(".local", d->label);
 		out(".comm %s, %d, %d\n", d->label, d->type->size, d->type->align);
 		return;
 	}
 	if(d->isglobal)
-		out(".globl %s\n", d->label);
-	out("%s:\n", d->label);
+		outdir(".globl", d->label);
+	outlabel(d->label);
 	
 	if(ischararray(d->type))
 	if(d->init->t == NSTR) {
-		out(".string %s\n", d->init->Str.v);
+		outdir(".string", d->init->Str.v);
 		return;
 	}
 	
 	if(ischarptr(d->type))
 	if(d->init->t == NSTR) {
 		l = newlabel();
-		out(".quad %s\n", l);
-		out("%s:\n", l);
-		out(".string %s\n", d->init->Str.v);
+		outdir(".quad", l);
+		outlabel(l);
+		outdir(".string", d->init->Str.v);
 		return;
 	}
 	if(isitype(d->type) || isptr(d->type)) {
@@ -1021,10 +2642,24 @@ data(Data *d)
 }
 
 
+static void
+flushdata(void)
+{
+	int  i;
+
+	if(!pendingdata->len)
+		return;
+	out(".data\n\n");
+	for(i = 0; i < pendingdata->len; i++)
+		data(vecget(pendingdata, i));
+	pendingdata->len = 0;
+	freearena(dataarena);
+}
+
 void
 emitsym(Sym *sym)
 {
-	out("# emit sym %s\n", sym->name);
+	outdir("# emit sym", sym->name);
 	switch(sym->k){
 	case SYMGLOBAL:
 		if(sym->Global.sclass == SCEXTERN)
@@ -1036,14 +2671,15 @@ emitsym(Sym *sym)
 		penddata(sym->Global.label, sym->type, sym->init, sym->Global.sclass == SCGLOBAL);
 		break;
 	case SYMLOCAL:
-		if(sym->init) {
-			expr(sym->init);
-			pushq("rax");
-			outi("leaq %d(%%rbp), %%rax\n", sym->Local.slot->offset);
-			popq("rcx");
+		if(sym->init && sym->Local.reg) {
+			expr(sym->init, 0);
+			storereg(sym->type, sym->Local.reg, RAX);
+		} else if(sym->init) {
+			expr(sym->init, 0);
+			insmr("leaq", sym->Local.slot->offset, "rbp", "rcx");
 			if(!isptr(sym->type) && !isitype(sym->type) && !isstruct(sym->type))
 				errorf("unimplemented init\n");
-			store(sym->type);
+			store(sym->type, RCX, RAX);
 		}
 		break;
 	case SYMENUM:
@@ -1056,10 +2692,7 @@ emitsym(Sym *sym)
 void
 emitend()
 {
-	int  i;
-	
-	out(".data\n\n");
-	for(i = 0; i < pendingdata->len; i++)
-		data(vecget(pendingdata, i));
+	flushdata();
+	oflush();
 }
 
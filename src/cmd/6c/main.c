@@ -5,18 +5,19 @@
 void
 usage()
 {
-	puts("Usage: 6c file.c");
+	puts("Usage: 6c [-v] [-I dir] file.c");
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-	int   i;
+	int   i, verbose;
 	Vec  *includedirs;
 	char *cfile;
 	
 	cfile = 0;
+	verbose = 0;
 	includedirs = vec();
 	for(i = 1; i < argc; i++) {
 		if(strcmp(argv[i], "-I") == 0) {
@@ -24,6 +25,8 @@ main(int argc, char *argv[])
 			if(i >= argc)
 				errorf("-I requires an include path\n");
 			vecappend(includedirs, argv[i]);
+		} else if(strcmp(argv[i], "-v") == 0) {
+			verbose = 1;
 		} else if(strncmp(argv[i], "-I", 2) == 0) {
 			vecappend(includedirs, argv[i]+2);
 		} else {
@@ -40,5 +43,7 @@ main(int argc, char *argv[])
 	emitinit(stdout);
 	parse();
 	emitend();
+	if(verbose)
+		cppreport(stderr);
 	return 0;
 }
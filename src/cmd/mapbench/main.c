@@ -0,0 +1,60 @@
+#include "u.h"
+#include "ds/ds.h"
+#include "mem/mem.h"
+#include <time.h>
+
+/* Measures Map lookup cost as the table grows.
+   The cost per lookup should stay flat. */
+
+#define NLOOKUPS 2000000
+
+static char **
+mkkeys(int n)
+{
+	char **keys;
+	char   buf[32];
+	int    i;
+
+	keys = xmalloc(n * sizeof(char *));
+	for(i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "sym%d", i);
+		keys[i] = xstrdup(buf);
+	}
+	return keys;
+}
+
+static void
+bench(char **keys, int n)
+{
+	Map    *m;
+	clock_t start, end;
+	int     i, found;
+	double  ns;
+
+	m = map();
+	for(i = 0; i < n; i++)
+		mapset(m, keys[i], keys[i]);
+	found = 0;
+	start = clock();
+	for(i = 0; i < NLOOKUPS; i++) {
+		if(mapget(m, keys[i % n]))
+			found++;
+	}
+	end = clock();
+	if(found != NLOOKUPS)
+		panic("lookup failed");
+	ns = (double)(end - start) * 1e9 / CLOCKS_PER_SEC / NLOOKUPS;
+	printf("%8d entries  %6.1f ns/lookup\n", n, ns);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char **keys;
+	int    n;
+
+	keys = mkkeys(100000);
+	for(n = 10; n <= 100000; n *= 10)
+		bench(keys, n);
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <u.h>
+#include <mem/mem.h>
+#include "ds.h"
+
+#define DQINITCAP 64
+
+Deque *
+deque()
+{
+	Deque *q;
+
+	q = xmalloc(sizeof(Deque));
+	q->arena = getarena();
+	q->cap = DQINITCAP;
+	q->d = arenaalloc(q->arena, q->cap * sizeof(void*));
+	return q;
+}
+
+/* Makes room for n elements. The elements are unwrapped
+   into the new buffer so the head is at index 0 again. */
+void
+dqreserve(Deque *q, int n)
+{
+	void **nd;
+	int    i, cap;
+
+	if(q->cap >= n)
+		return;
+	cap = q->cap;
+	while(cap < n)
+		cap = cap * 2;
+	nd = arenaalloc(q->arena, cap * sizeof(void*));
+	for(i = 0; i < q->len; i++)
+		nd[i] = q->d[(q->head + i) & (q->cap - 1)];
+	q->d = nd;
+	q->cap = cap;
+	q->head = 0;
+}
+
+void
+dqpushfront(Deque *q, void *v)
+{
+	if(q->len == q->cap)
+		dqreserve(q, q->len + 1);
+	q->head = (q->head - 1) & (q->cap - 1);
+	q->d[q->head] = v;
+	q->len++;
+}
+
+void *
+dqpopfront(Deque *q)
+{
+	void *v;
+
+	if(!q->len)
+		panic("pop from empty deque");
+	v = q->d[q->head];
+	q->head = (q->head + 1) & (q->cap - 1);
+	q->len--;
+	return v;
+}
@@ -1,26 +1,31 @@
 /* Provides generic data structures. */
 
-typedef struct ListEnt ListEnt;
-struct ListEnt {
-	ListEnt *next;
-	void *v;
+/*	Deque is a ring buffer of pointers, pushed and popped
+	at the front. The capacity is a power of two. */
+typedef struct Deque Deque;
+struct Deque {
+	int    len;
+	int    cap;
+	int    head; /* Index of the first element */
+	void **d;
+	struct Arena *arena;
 };
 
-typedef struct List List;
-struct List {
-	int     len;
-	ListEnt *head;
-};
-
-List *list();
-void listappend(List *, void *);
-void listprepend(List *, void *);
-void listinsert(List *, int, void *);
-void *listpopfront(List *);
+Deque *deque();
+void   dqreserve(Deque *, int);
+void   dqpushfront(Deque *, void *);
+void  *dqpopfront(Deque *);
 
+/*	Map is a hash table keyed by strings.
+	Keys are not copied and must outlive the map. Like Vec,
+	the table grows in the arena current when the Map was made. */
+typedef struct MapEnt MapEnt;
 typedef struct Map Map;
 struct Map {
-	List *l;
+	int     len;
+	int     cap;
+	MapEnt *tab;
+	struct Arena *arena;
 };
 
 Map  *map();
@@ -28,23 +33,18 @@ void *mapget(Map *, char *);
 void  mapdel(Map *, char *);
 void  mapset(Map *, char *, void *);
 
-/*	StrSet is an immutable set of strings.
-	The null pointer is the empty set. */
-typedef struct StrSet StrSet;
-struct StrSet {
-	StrSet *next;
-	char *v;
-};
-
-StrSet *strsetadd(StrSet *, char *);
-int     strsethas(StrSet *, char *);
-StrSet *strsetintersect(StrSet *, StrSet *);
+/*	Vec is a growable array of pointers. Storage comes from
+	the arena current when the Vec was made, and doubles as it
+	grows. Up to VECINLINE elements are kept inside the Vec. */
+#define VECINLINE 4
 
 typedef struct Vec Vec;
 struct Vec {
 	int   cap;
 	int   len;
 	void  **d;
+	struct Arena *arena;
+	void  *inl[VECINLINE];
 };
 
 Vec  *vec();
@@ -2,49 +2,142 @@
 #include <mem/mem.h>
 #include "ds.h"
 
-typedef struct MapEnt MapEnt;
+/* Open addressing with linear probing. An entry with a null
+   key is empty. The hash of each key is cached so probing and
+   growing never rehash or strcmp a key that cannot match. */
+
 struct MapEnt {
-	char *k;
-	void *v;
+	char   *k;
+	void   *v;
+	uint32  h;
 };
 
-Map *map()
+#define MAPINITCAP 16
+
+static uint32
+strhash(char *s)
+{
+	uint32 h;
+
+	/* FNV-1a */
+	h = 2166136261u;
+	while(*s) {
+		h = (h ^ *s) * 16777619;
+		s++;
+	}
+	return h;
+}
+
+Map *
+map()
 {
 	Map *m;
 
 	m = xmalloc(sizeof(Map));
-	m->l = list();
+	m->arena = getarena();
+	m->cap = MAPINITCAP;
+	m->tab = arenaalloc(m->arena, m->cap * sizeof(MapEnt));
 	return m;
 }
 
-void 
+/* Returns the slot holding k, or the empty slot where k belongs. */
+static int
+mapfind(Map *m, char *k, uint32 h)
+{
+	MapEnt *e;
+	int     i;
+
+	i = h & (m->cap - 1);
+	for(;;) {
+		e = &m->tab[i];
+		if(!e->k)
+			return i;
+		if(e->h == h)
+		if(e->k == k || strcmp(e->k, k) == 0)
+			return i;
+		i = (i + 1) & (m->cap - 1);
+	}
+}
+
+static void
+mapgrow(Map *m)
+{
+	MapEnt *old;
+	int     i, oldcap;
+
+	old = m->tab;
+	oldcap = m->cap;
+	m->cap = oldcap * 2;
+	m->tab = arenaalloc(m->arena, m->cap * sizeof(MapEnt));
+	for(i = 0; i < oldcap; i++) {
+		if(!old[i].k)
+			continue;
+		m->tab[mapfind(m, old[i].k, old[i].h)] = old[i];
+	}
+}
+
+void
 mapset(Map *m, char *k, void *v)
 {
-	MapEnt *me;
+	MapEnt *e;
+	uint32  h;
 
-	me = xmalloc(sizeof(MapEnt));
-	me->k = k;
-	me->v = v;
-	listprepend(m->l, me);
+	h = strhash(k);
+	e = &m->tab[mapfind(m, k, h)];
+	if(e->k) {
+		e->v = v;
+		return;
+	}
+	if((m->len + 1) * 4 > m->cap * 3) {
+		mapgrow(m);
+		e = &m->tab[mapfind(m, k, h)];
+	}
+	e->k = k;
+	e->v = v;
+	e->h = h;
+	m->len++;
 }
 
 void *
 mapget(Map *m, char *k)
 {
-	MapEnt *me;
-	ListEnt *e;
+	MapEnt *e;
 
-	for(e = m->l->head; e != 0; e = e->next) {
-		me = e->v;
-		if(strcmp(me->k, k) == 0)
-			return me->v;
-	}
-	return 0;
+	e = &m->tab[mapfind(m, k, strhash(k))];
+	if(!e->k)
+		return 0;
+	return e->v;
 }
 
+/* Removes k by shifting the rest of its probe run back,
+   so lookups never have to step over tombstones. */
 void
 mapdel(Map *m, char *k)
 {
-	mapset(m, k, 0);
-}
+	int i, j, home, mask;
 
+	mask = m->cap - 1;
+	i = mapfind(m, k, strhash(k));
+	if(!m->tab[i].k)
+		return;
+	j = i;
+	for(;;) {
+		j = (j + 1) & mask;
+		if(!m->tab[j].k)
+			break;
+		home = m->tab[j].h & mask;
+		/* Entries whose home lies cyclically in (i, j] stay put. */
+		if(i <= j) {
+			if(i < home && home <= j)
+				continue;
+		} else {
+			if(i < home || home <= j)
+				continue;
+		}
+		m->tab[i] = m->tab[j];
+		i = j;
+	}
+	m->tab[i].k = 0;
+	m->tab[i].v = 0;
+	m->len--;
+}
@@ -8,9 +8,10 @@ vec()
 	Vec *v;
 
 	v = xmalloc(sizeof(Vec));
+	v->arena = getarena();
 	v->len = 0;
-	v->cap = 16;
-	v->d = xmalloc(sizeof(void*) * v->cap);
+	v->cap = VECINLINE;
+	v->d = &v->inl[0];
 	return v;
 }
 
@@ -30,17 +31,21 @@ vecset(Vec *v, int idx, void *x)
 	v->d[idx] = x;
 }
 
+/* Moves the elements to a buffer of cap slots in the arena. Only
+   the arena buffer can be resized in place, inline slots are copied. */
 static void
 vecresize(Vec *v, int cap)
 {
-	int i;
 	void **nd;
-
-	if(v->cap >= cap)
-		return;
-	nd = xmalloc(cap*sizeof(void*));
-	for(i = 0; i < v->len; i++)
-		nd[i] = v->d[i];
+	int    i;
+
+	if(v->d == &v->inl[0]) {
+		nd = arenaalloc(v->arena, cap * sizeof(void*));
+		for(i = 0; i < v->len; i++)
+			nd[i] = v->d[i];
+	} else {
+		nd = arenarealloc(v->arena, v->d, v->cap * sizeof(void*), cap * sizeof(void*));
+	}
 	v->d = nd;
 	v->cap = cap;
 }
@@ -49,25 +54,7 @@ void
 vecappend(Vec *v, void *x)
 {
 	if(v->len == v->cap)
-		vecresize(v, v->len + 16);
+		vecresize(v, v->cap * 2);
 	v->d[v->len] = x;
 	v->len++;
 }
-
-int
-vecremove(Vec *v, void *x)
-{
-	int i;
-
-	for(i = 0; i < v->len; i++) {
-		if(v->d[i] == x)
-			break;
-	}
-	if(i == v->len)
-		return 0;
-	for(; i < v->len - 1; i++) {
-		v->d[i] = v->d[i+1];
-	}
-	v->len -= 1;
-	return 1;
-}
@@ -1,30 +1,167 @@
 #include <u.h>
 #include "mem.h"
 
-char *
-xstrdup(char *s)
+/* Allocations larger than BIGALLOC get a chunk of their own
+   so they do not waste the tail of the current chunk. */
+#define CHUNKSZ  (64*1024)
+#define BIGALLOC (CHUNKSZ/4)
+
+typedef struct Chunk Chunk;
+struct Chunk {
+	Chunk *next;
+	int64  pad; /* keep the data 16 byte aligned */
+};
+
+struct Arena {
+	Chunk *chunks;
+	char  *p;
+	int    avail;
+};
+
+static Arena *curarena;
+
+/* calloc hands back fresh pages for large requests,
+   so the memory is already zero and we never clear it by hand. */
+static Chunk *
+newchunk(int sz)
 {
-	int  l;
-	char *r;
+	Chunk *c;
 
-	l = strlen(s);
-	r = xmalloc(l + 1);
-	strncpy(r, s, l);
-	return r;
+	c = calloc(1, sizeof(Chunk) + sz);
+	if(!c)
+		panic("out of memory!");
+	return c;
 }
 
-void *
-xmalloc(int n)
+Arena *
+newarena(void)
 {
-	char *v;
-	int  i;
+	Arena *a;
 
-	v = malloc(n);
-	if(!v)
+	a = calloc(1, sizeof(Arena));
+	if(!a)
 		panic("out of memory!");
-	for(i = 0; i < n; i++)
-		v[i] = 0;
+	return a;
+}
+
+void *
+arenaalloc(Arena *a, int n)
+{
+	Chunk *c;
+	char  *v;
+
+	if(n < 0)
+		panic("internal error - negative allocation");
+	n = (n + 15) & ~15;
+	if(n > a->avail) {
+		if(n > BIGALLOC) {
+			c = newchunk(n);
+			if(a->chunks) {
+				c->next = a->chunks->next;
+				a->chunks->next = c;
+			} else {
+				a->chunks = c;
+			}
+			return c + 1;
+		}
+		c = newchunk(CHUNKSZ);
+		c->next = a->chunks;
+		a->chunks = c;
+		a->p = (char*)(c + 1);
+		a->avail = CHUNKSZ;
+	}
+	v = a->p;
+	a->p = a->p + n;
+	a->avail -= n;
+	return v;
+}
+
+/* Resizes p, an allocation of oldn bytes from a, to n bytes.
+   The most recent allocation of the current chunk is resized
+   in place, anything else is copied to a new allocation. */
+void *
+arenarealloc(Arena *a, void *p, int oldn, int n)
+{
+	char *v, *end;
+
+	if(n < 0)
+		panic("internal error - negative allocation");
+	oldn = (oldn + 15) & ~15;
+	n = (n + 15) & ~15;
+	v = p;
+	end = v + oldn;
+	if(p && end == a->p) {
+		if(n <= oldn) {
+			/* Hand the tail back zeroed, as it was. */
+			memset(v + n, 0, oldn - n);
+			a->p = v + n;
+			a->avail += oldn - n;
+			return p;
+		}
+		if(n - oldn <= a->avail) {
+			a->p = v + n;
+			a->avail -= n - oldn;
+			return p;
+		}
+	}
+	v = arenaalloc(a, n);
+	if(p) {
+		if(oldn > n)
+			oldn = n;
+		memcpy(v, p, oldn);
+	}
 	return v;
 }
 
+/* Release every allocation made from the arena,
+   the arena itself can be reused afterwards. */
+void
+freearena(Arena *a)
+{
+	Chunk *c, *next;
+
+	for(c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = 0;
+	a->p = 0;
+	a->avail = 0;
+}
+
+/* Make a the arena used by xmalloc, returning the previous one. */
+Arena *
+setarena(Arena *a)
+{
+	Arena *prev;
+
+	prev = curarena;
+	curarena = a;
+	return prev;
+}
+
+Arena *
+getarena(void)
+{
+	if(!curarena)
+		curarena = newarena();
+	return curarena;
+}
+
+void *
+xmalloc(int n)
+{
+	return arenaalloc(getarena(), n);
+}
 
+char *
+xstrdup(char *s)
+{
+	int  l;
+	char *r;
+
+	l = strlen(s);
+	r = xmalloc(l + 1);
+	strncpy(r, s, l);
+	return r;
+}
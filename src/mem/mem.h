@@ -1,3 +1,18 @@
+/* Provides memory allocation.
+
+   Memory is carved out of arenas with pointer bumps and
+   only returned in bulk by freearena. xmalloc allocates from
+   the current arena, which a phase can swap with setarena.
+   All returned memory is zeroed. */
+
+typedef struct Arena Arena;
+
+Arena *newarena(void);
+void  *arenaalloc(Arena *, int);
+void  *arenarealloc(Arena *, void *, int, int);
+void   freearena(Arena *);
+Arena *setarena(Arena *);
+Arena *getarena(void);
 
 void *xmalloc(int);
 char *xstrdup(char *);
@@ -12,4 +12,5 @@ typedef __va_elem va_list[1];
 #define va_end(X) (X)
 
 int vfprintf(FILE *stream, const char *format, va_list ap);
+int vsnprintf(char *str, long long size, const char *format, va_list ap);
 
@@ -1,5 +1,7 @@
 
 #define EOF -1
+#define SEEK_SET 0
+#define SEEK_END 2
 
 typedef struct FILE FILE;
 extern FILE *stdout, *stderr;
@@ -14,4 +16,8 @@ int   fputs(const char *s, FILE *stream);
 int   fputc(int c, FILE *stream);
 FILE *fopen(const char *, const char *);
 int  *fclose(FILE *);
+long  fread(void *, long, long, FILE *);
+long  fwrite(const void *, long, long, FILE *);
+int   fseek(FILE *, long, int);
+long  ftell(FILE *);
 
@@ -1,5 +1,9 @@
 
 long long atoll(const char *);
+long long strtoll(const char *, char **, int);
+unsigned long long strtoull(const char *, char **, int);
 void  qsort(void *, long , long ,int (*)(const void *, const void *));
 void *malloc(long size);
+void *calloc(long, long);
+void  free(void *);
 void  exit(int);
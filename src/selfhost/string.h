@@ -3,3 +3,5 @@ int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, long n);
 long strlen(const char *s);
 char *strncpy(char *dest, const char *src, long n);
+void *memcpy(void *dest, const void *src, long n);
+void *memset(void *s, int c, long n);
@@ -6,7 +6,8 @@ for T in test/execute/*.c test/cpp/*.c test/bugs/*.c
 do
 	if ! ( bin/6c $T > $T.s &&
            gcc -c $T.s -o $T.o &&
-           gcc $T.o -o $T.bin && 
+           gcc $T.o -o $T.bin 2> $T.ldout &&
+           ! grep -q "TEXTREL\|relocation in read-only" $T.ldout &&
            $T.bin > /dev/null )
 	then
 		echo $T FAIL
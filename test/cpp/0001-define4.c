@@ -0,0 +1,40 @@
+#define ADD(X, Y) ((X) + (Y))
+#define CALL(F, ARGS) F ARGS
+#define ZERO() 0
+#define TWICE(X) ADD(X, X)
+#define A B
+#define B A
+#define SELF(X) SELF(X)
+
+int
+add(int a, int b)
+{
+	return a + b;
+}
+
+int
+SELF(int x)
+{
+	return x;
+}
+
+int
+main()
+{
+	int A;
+
+	A = 1;
+	if(ADD(add(1, 2), 3) != 6)
+		return 1;
+	if(CALL(add, (2, 3)) != 5)
+		return 2;
+	if(ZERO() != 0)
+		return 3;
+	if(TWICE(TWICE(2)) != 8)
+		return 4;
+	if(A != 1)
+		return 5;
+	if(SELF(7) != 7)
+		return 6;
+	return 0;
+}
@@ -0,0 +1,20 @@
+#define f(a) a*g
+#define g(a) f(a)
+#define h(x) x + h
+#define id(x) x
+
+int
+main()
+{
+	int g, h;
+
+	g = 3;
+	h = 4;
+	if(f(2)(9) != 54)
+		return 1;
+	if(id(id(h(1))) != 5)
+		return 2;
+	if(id(h)(2) != 6)
+		return 3;
+	return 0;
+}
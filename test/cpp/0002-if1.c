@@ -0,0 +1,60 @@
+#define A 3
+#define B(X) (X * 2)
+
+#if 0
+#error not skipped
+don't care about 'quotes' or "strings
+#if 1
+#else
+#endif
+#endif
+
+#if A == 3 && B(A) == 6
+int x = 1;
+#elif A
+int x = 2;
+#else
+int x = 3;
+#endif
+
+#if A > 5
+int y = 1;
+#elif A > 2
+int y = 2;
+#elif A > 1
+int y = 3;
+#else
+int y = 4;
+#endif
+
+#if 0 /* comment
+#endif
+*/
+int z = 1;
+#else
+int z = 2;
+#endif
+
+#if (1 ? 2 : 1/0) == 2 && (0 && 1/0) == 0 && -1 < 0 && ~0 == -1
+int w = 1;
+#endif
+
+#if 0x10 == 16 && 010 == 8 && 'a' == 97 && (1 << 4) == 16 && 10 % 4 == 2
+int v = 1;
+#endif
+
+int
+main()
+{
+	if(x != 1)
+		return 1;
+	if(y != 2)
+		return 2;
+	if(z != 2)
+		return 3;
+	if(w != 1)
+		return 4;
+	if(v != 1)
+		return 5;
+	return 0;
+}
@@ -0,0 +1,50 @@
+#define FOO
+
+#ifdef FOO
+int a = 1;
+#else
+int a = 2;
+#endif
+
+#ifndef FOO
+int b = 1;
+#else
+int b = 2;
+#endif
+
+#if defined FOO && defined(FOO) && !defined BAR && UNDEFINED == 0
+int c = 1;
+#endif
+
+#ifdef BAR
+#ifdef FOO
+int d = 1;
+#elif 1
+int d = 2;
+#else
+int d = 3;
+#endif
+#else
+int d = 4;
+#endif
+
+#undef FOO
+#ifndef FOO
+int e = 1;
+#endif
+
+int
+main()
+{
+	if(a != 1)
+		return 1;
+	if(b != 2)
+		return 2;
+	if(c != 1)
+		return 3;
+	if(d != 4)
+		return 4;
+	if(e != 1)
+		return 5;
+	return 0;
+}
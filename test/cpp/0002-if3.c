@@ -0,0 +1,47 @@
+/* #if arithmetic is long or unsigned long. */
+#if -1 > 0u
+int a = 1;
+#else
+int a = 2;
+#endif
+
+#if 0xffffffffffffffff > 0 && -1 < 0 && 18446744073709551615 / 2 == 0x7fffffffffffffff
+int b = 1;
+#else
+int b = 2;
+#endif
+
+#if 0xffffffffffffffff / 3 == 0x5555555555555555 && 18446744073709551615 % 10 == 5 \
+    && -1u / 0x8000000000000000 == 1 && 5u / -1 == 0 && -1u % -2 == 1
+int e = 1;
+#else
+int e = 2;
+#endif
+
+#if (-1u >> 63) == 1 && (-1 >> 63) == -1 && -3u % 2 == 1 && -4 / 2 == -2
+int c = 1;
+#else
+int c = 2;
+#endif
+
+#if (1 ? 0u : 0) - 1 > 0 && !(0u - 1 < 0) && (1 < 2) - 2 < 0
+int d = 1;
+#else
+int d = 2;
+#endif
+
+int
+main()
+{
+	if(a != 1)
+		return 1;
+	if(b != 1)
+		return 2;
+	if(c != 1)
+		return 3;
+	if(d != 1)
+		return 4;
+	if(e != 1)
+		return 5;
+	return 0;
+}
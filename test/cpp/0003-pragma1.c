@@ -0,0 +1,14 @@
+#pragma unknown pragmas are ignored
+
+#ifndef GUARD
+#define GUARD
+int x = 1;
+#endif
+
+int
+main()
+{
+	if(x != 1)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,19 @@
+#include "0004-include1.h"
+#include "0004-include1.h"
+#include "0004-include2.h"
+#include "0004-include2.h"
+
+int
+main()
+{
+	int count;
+
+	count = 0;
+#include "0004-include3.h"
+#include "0004-include3.h"
+	if(count != 2)
+		return 1;
+	if(a != 1 || b != 2)
+		return 2;
+	return 0;
+}
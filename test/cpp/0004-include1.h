@@ -0,0 +1,5 @@
+/* Guarded, a second include would redefine a. */
+#ifndef INCLUDE1_H
+#define INCLUDE1_H
+int a = 1;
+#endif
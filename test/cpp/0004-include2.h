@@ -0,0 +1,3 @@
+#pragma once
+/* A second include would redefine b. */
+int b = 2;
@@ -0,0 +1,2 @@
+/* Not guarded, each include adds one. */
+count++;
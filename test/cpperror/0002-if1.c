@@ -0,0 +1,6 @@
+/*
+PATTERN: unterminated #if
+*/
+
+#if 1
+int x;
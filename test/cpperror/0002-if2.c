@@ -0,0 +1,5 @@
+/*
+PATTERN: #else without #if
+PATTERN: c:5:
+*/
+#else
@@ -0,0 +1,6 @@
+/*
+PATTERN: division by zero
+PATTERN: c:5:
+*/
+#if 1 / 0
+#endif
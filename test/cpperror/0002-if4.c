@@ -0,0 +1,8 @@
+/*
+PATTERN: overflow
+PATTERN: c:6:
+*/
+#if 0 || (0 && (-9223372036854775807 - 1) % -1) || 1
+#if (-9223372036854775807 - 1) / -1
+#endif
+#endif
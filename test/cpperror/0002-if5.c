@@ -0,0 +1,6 @@
+/*
+PATTERN: overflow
+PATTERN: c:5:
+*/
+#if (-9223372036854775807 - 1) % -1
+#endif
@@ -0,0 +1,13 @@
+/*
+PATTERN: undefined
+PATTERN: c:12:12
+PATTERN: expansion of macro F
+*/
+
+#define F(a) (a + y)
+
+int
+main()
+{
+	return F(1);
+}
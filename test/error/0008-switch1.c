@@ -0,0 +1,24 @@
+/*
+PATTERN: duplicate
+PATTERN: c:14:5
+*/
+
+int
+f(int x)
+{
+	switch(x) {
+	case 1: return 10;
+	case 2: return 20;
+	case 3: return 30;
+	case 4: return 40;
+	case 1: return 50;
+	case 5: return 60;
+	}
+	return -1;
+}
+
+int
+main()
+{
+	return f(3);
+}
@@ -0,0 +1,31 @@
+struct s {
+	int a;
+	struct {
+		char b;
+		union {
+			int c;
+			char d;
+		};
+	};
+	int e;
+};
+
+int
+main()
+{
+	struct s v;
+	struct s *p;
+
+	p = &v;
+	v.a = 1;
+	v.b = 2;
+	v.c = 3;
+	v.e = 4;
+	if(p->a + p->b + p->c + p->e != 10)
+		return 1;
+	if(p->d != 3)
+		return 2;
+	if(sizeof(struct s) != 16)
+		return 3;
+	return 0;
+}
@@ -0,0 +1,19 @@
+int a;
+int b;
+int a;
+int c;
+int b = 2;
+int c;
+int a;
+
+int
+main()
+{
+	if(a != 0)
+		return 1;
+	if(b != 2)
+		return 2;
+	a = 1;
+	c = 3;
+	return a + b + c - 6;
+}
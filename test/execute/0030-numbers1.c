@@ -0,0 +1,18 @@
+
+int
+main()
+{
+	if(0x10 != 16)
+		return 1;
+	if(0xff != 255)
+		return 2;
+	if(0XaBc != 2748)
+		return 3;
+	if(010 != 8)
+		return 4;
+	if(0 != 0)
+		return 5;
+	if(123u != 123)
+		return 6;
+	return 0;
+}
@@ -0,0 +1,41 @@
+int x = 1;
+struct s { int a; };
+
+int
+main()
+{
+	int r;
+
+	r = 0;
+	{
+		int x;
+		struct s { int a; int b; };
+		struct s v;
+
+		x = 2;
+		v.b = 3;
+		{
+			int x;
+
+			x = 4;
+			r = r + x;
+		}
+		r = r + x + v.b;
+		if(sizeof(struct s) != 8)
+			return 1;
+	}
+	if(sizeof(struct s) != 4)
+		return 2;
+	if(x != 1)
+		return 3;
+	if(r != 9)
+		return 4;
+	{
+		int x;
+
+		x = 5;
+		if(x != 5)
+			return 5;
+	}
+	return x - 1;
+}
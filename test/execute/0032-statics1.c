@@ -0,0 +1,45 @@
+int
+counter()
+{
+	static int n;
+	static int step = 2;
+
+	n = n + step;
+	return n;
+}
+
+char *
+greeting()
+{
+	static char *s = "hi";
+
+	return s;
+}
+
+int
+localtypes()
+{
+	struct pair { int a; int b; } p;
+	int (*fp)(void);
+
+	fp = counter;
+	p.a = 1;
+	p.b = fp();
+	return p.a + p.b;
+}
+
+int
+main()
+{
+	if(counter() != 2)
+		return 1;
+	if(counter() != 4)
+		return 2;
+	if(greeting()[0] != 'h' || greeting()[1] != 'i')
+		return 3;
+	if(localtypes() != 7)
+		return 4;
+	if(localtypes() != 9)
+		return 5;
+	return 0;
+}
@@ -0,0 +1,85 @@
+struct s { int a; int b; };
+
+#define A1 ((a+b)+(c+d))
+#define A2 (A1+A1)
+#define A3 (A2+A2)
+#define A4 (A3+A3)
+#define A5 (A4+A4)
+#define A6 (A5+A5)
+#define A7 (A6+A6)
+
+#define D1 (((d*c)/(c-b)+(d%c))*((d<<a)-(c>>a)))
+#define D2 (D1-(D1/(c-a)))
+#define D3 (D2+D2)
+#define D4 (D3*(D3/(D3/b)))
+#define D5 (D4/(D4%(d+a)))
+#define D6 (D5<<(D5/D5))
+#define D7 (D6%(D6-a))
+
+int
+id(int x)
+{
+	return x;
+}
+
+int
+sum3(int a, int b, int c)
+{
+	return a + b + c;
+}
+
+int
+main()
+{
+	int a, b, c, d, i;
+	int v[4];
+	struct s s1, s2;
+	struct s *p;
+
+	a = 1;
+	b = 2;
+	c = 3;
+	d = 4;
+	/* Balanced trees deep enough to run out of registers. */
+	if(A7 != 640)
+		return 1;
+	if(D7 != 1)
+		return 2;
+	/* The right side needs more registers than the left. */
+	if(a - ((b * c) - (d / (a + a))) != -3)
+		return 3;
+	if(d / ((a + a) * (a + 0)) != 2)
+		return 4;
+	if(d % (c - (a - (b - a))) != 1)
+		return 5;
+	if(a << ((b + c) - (d - a)) != 4)
+		return 6;
+	/* Calls with values live in registers. */
+	if(a + (b * (c + id(d))) != 15)
+		return 7;
+	if(id(a) + id(b) * id(c) - sum3(id(a), b + c, d * id(d)) != -15)
+		return 8;
+	if((c - id(a)) / (id(b) - (a - id(a))) != 1)
+		return 9;
+	/* Stores and loads of every size through registers. */
+	for(i = 0; i < 4; i++)
+		v[i] = i * (i + a);
+	if(v[id(3)] + v[v[2] - 4] * (v[1] + v[a]) != 36)
+		return 10;
+	v[b] += v[c] - (v[a] = 5);
+	if(v[2] != 13 || v[1] != 5)
+		return 11;
+	i = 0;
+	v[i++] = (a + b) * (c + d);
+	if(v[0] != 21 || i != 1)
+		return 12;
+	p = &s2;
+	s1.a = 7;
+	s1.b = 8;
+	*p = s1;
+	if(p->a + p->b * (s2.a - s1.b) != -1)
+		return 13;
+	if(!(a < b) + (c > d) * 2 + (a == a) * 4 + (b != b) * 8 + (c <= c) * 16 + (d >= c) * 32 != 52)
+		return 14;
+	return 0;
+}
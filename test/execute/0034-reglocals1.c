@@ -0,0 +1,120 @@
+int
+id(int x)
+{
+	return x;
+}
+
+int
+sum(int *p, int n)
+{
+	int *end;
+	int  s;
+
+	s = 0;
+	for(end = p + n; p != end; p++)
+		s += *p;
+	return s;
+}
+
+int
+many(int a, int b, int c, int d, int e, int f, int g, char h)
+{
+	return a + b + c + d + e + f + g * 100 + h * 1000;
+}
+
+void
+settwo(int *p)
+{
+	*p = 2;
+}
+
+int
+wide()
+{
+	int a, b, c, d, e, f, g;
+
+	a = id(1);
+	b = id(2);
+	c = id(3);
+	d = id(4);
+	e = id(5);
+	f = id(6);
+	g = id(7);
+	return a + b * c + d * e + f * g + id(a + g);
+}
+
+int
+jumps()
+{
+	int i, s;
+
+	i = 0;
+	s = 0;
+again:
+	s += i;
+	i++;
+	if(i < 5)
+		goto again;
+	return s;
+}
+
+int
+main()
+{
+	int   v[10];
+	int   i, j, k, t;
+	char  c;
+	short sh;
+	char *s;
+
+	for(i = 0; i < 10; i++)
+		v[i] = i;
+	if(sum(v, 10) != 45)
+		return 1;
+	if(many(1, 2, 3, 4, 5, 6, 7, 2) != 2721)
+		return 2;
+	c = 127;
+	c++;
+	if(c != -128)
+		return 3;
+	c = 100;
+	c += 100;
+	if(c != -56)
+		return 4;
+	sh = 32767;
+	if(++sh != -32768)
+		return 5;
+	if((c = 300) != 44)
+		return 6;
+	t = 1;
+	settwo(&t);
+	if(t != 2)
+		return 7;
+	if(wide() != 1 + 6 + 20 + 42 + 8)
+		return 8;
+	if(jumps() != 10)
+		return 9;
+	k = 0;
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			k += i * j;
+	if(k != 36)
+		return 10;
+	s = "abc";
+	i = 0;
+	while(*s++)
+		i++;
+	if(i != 3)
+		return 11;
+	i = 5;
+	j = i--;
+	if(j != 5 || i != 4 || --i != 3)
+		return 12;
+	i = 7;
+	i *= 3;
+	i |= 8;
+	i -= i << 1;
+	if(i != -29)
+		return 13;
+	return 0;
+}
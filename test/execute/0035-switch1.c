@@ -0,0 +1,96 @@
+int
+dense(int x)
+{
+	switch(x) {
+	case 0: return 10;
+	case 1: return 11;
+	case 2: return 12;
+	case 4: return 14;
+	case 5:
+	case 6: return 16;
+	case 7: return 17;
+	case 9: return 19;
+	default: return -1;
+	}
+}
+
+int
+sparse(int x)
+{
+	switch(x) {
+	case -1000: return 1;
+	case -3: return 2;
+	case 7: return 3;
+	case 100: return 4;
+	case 1000: return 5;
+	case 5000: return 6;
+	case 70000: return 7;
+	case 123456: return 8;
+	}
+	return 0;
+}
+
+int
+mixed(int x)
+{
+	int r;
+
+	r = 0;
+	switch(x) {
+	case 200: r += 1;
+	case 201: r += 2; break;
+	case 202: r = 7; break;
+	case 203: r = 8; break;
+	case 204: r = 9; break;
+	case 1: r = 100; break;
+	case 99999: r = 101; break;
+	case -50: r = 102; break;
+	case -51: r = 103; break;
+	}
+	return r;
+}
+
+/* The range of these cases does not fit in a long. */
+int
+extremes(long x)
+{
+	switch(x) {
+	case -9223372036854775807 - 1: return 1;
+	case -9223372036854775807: return 2;
+	case 0: return 3;
+	case 9223372036854775806: return 4;
+	case 9223372036854775807: return 5;
+	}
+	return 0;
+}
+
+int
+main()
+{
+	int i, s;
+
+	s = 0;
+	for(i = -2; i < 12; i++)
+		s += dense(i);
+	if(s != 10 + 11 + 12 + 14 + 16 + 16 + 17 + 19 - 6)
+		return 1;
+	if(sparse(-1000) != 1 || sparse(-3) != 2 || sparse(7) != 3 || sparse(100) != 4)
+		return 2;
+	if(sparse(1000) != 5 || sparse(5000) != 6 || sparse(70000) != 7 || sparse(123456) != 8)
+		return 3;
+	if(sparse(0) != 0 || sparse(-2000) != 0 || sparse(200000) != 0 || sparse(101) != 0)
+		return 4;
+	if(mixed(200) != 3 || mixed(201) != 2 || mixed(202) != 7 || mixed(204) != 9)
+		return 5;
+	if(mixed(1) != 100 || mixed(99999) != 101 || mixed(-50) != 102 || mixed(-51) != 103)
+		return 6;
+	if(mixed(205) != 0 || mixed(199) != 0 || mixed(0) != 0)
+		return 7;
+	if(extremes(-9223372036854775807 - 1) != 1 || extremes(-9223372036854775807) != 2)
+		return 8;
+	if(extremes(0) != 3 || extremes(9223372036854775806) != 4 || extremes(9223372036854775807) != 5)
+		return 9;
+	if(extremes(1) != 0 || extremes(-1) != 0)
+		return 10;
+	return 0;
+}
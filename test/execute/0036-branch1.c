@@ -0,0 +1,63 @@
+int calls;
+
+int
+t(int v)
+{
+	calls++;
+	return v;
+}
+
+int
+main()
+{
+	int a, b, i, n;
+
+	a = 3;
+	b = 5;
+	if(!(a < b))
+		return 1;
+	if(a > b || a == b || !(a != b))
+		return 2;
+	if(a <= b && b >= a && !(a >= b))
+		;
+	else
+		return 3;
+	calls = 0;
+	if(t(0) && t(1))
+		return 4;
+	if(calls != 1)
+		return 5;
+	if(!(t(1) || t(0)))
+		return 6;
+	if(calls != 2)
+		return 7;
+	if(!(t(0) || t(1) && t(1)))
+		return 8;
+	if(calls != 5)
+		return 9;
+	if(!((a < b) + (b < a) * 2 + !a * 4 + !!b * 8 == 9))
+		return 10;
+	if((a < b && b < 10) != 1 || (a > b || b > 10) != 0)
+		return 11;
+	n = 0;
+	for(i = 0; i < 10 && !(i == 7); i++)
+		n++;
+	if(n != 7)
+		return 12;
+	i = 0;
+	while(!(i >= 4) || i == 4)
+		i++;
+	if(i != 5)
+		return 13;
+	i = 0;
+	do
+		i += 2;
+	while(i < 9 && i != 6);
+	if(i != 6)
+		return 14;
+	if((a > b ? 1 : a < b && b ? 2 : 3) != 2)
+		return 15;
+	if(!a)
+		return 16;
+	return 0;
+}
@@ -0,0 +1,61 @@
+enum { TEN = 10 };
+
+long  g = 40;
+char  gc = -3;
+short gs = 300;
+
+struct buf {
+	int   pad;
+	long  len;
+	char *p;
+};
+
+int
+main()
+{
+	long       n, *q;
+	int        i, a[4], *ap;
+	struct buf b;
+	struct buf *bp;
+
+	n = 7;
+	q = &n;
+	if(n + 1 != 8 || 1 + n != 8 || n - 2 != 5 || 2 - n != -5)
+		return 1;
+	if(n * 3 != 21 || (n & 3) != 3 || (n | 8) != 15 || (n ^ 1) != 6)
+		return 2;
+	if((n << 2) != 28 || (n >> 1) != 3 || (-n >> 1) != -4)
+		return 3;
+	if(g + n != 47 || g - n != 33 || n - g != -33)
+		return 4;
+	if(gc + 1 != -2 || gs * 2 != 600)
+		return 5;
+	if(!(5 < n) || 8 <= n || !(TEN > n) || sizeof(long) != 8)
+		return 6;
+	if((5 < n) + (n >= 7) * 2 + (n == TEN) * 4 != 3)
+		return 7;
+	a[0] = 1;
+	a[1] = 2;
+	a[2] = 3;
+	a[3] = 4;
+	ap = &a[0];
+	if(*(ap + 2) != 3 || *(ap + 3) - *(ap + 0) != 3)
+		return 8;
+	i = 0;
+	i += 5;
+	i *= 3;
+	i -= g;
+	i |= 1;
+	if(i != -25)
+		return 9;
+	bp = &b;
+	bp->len = 12;
+	if(bp->len < 16)
+		;
+	else
+		return 10;
+	*q = *q + 1;
+	if(n != 8 || q[0] != 8)
+		return 11;
+	return 0;
+}
@@ -0,0 +1,62 @@
+struct s3 {
+	char a;
+	char b;
+	char c;
+};
+
+struct s12 {
+	int a;
+	int b;
+	int c;
+};
+
+struct s40 {
+	long pad[4];
+	int  v;
+};
+
+int
+main()
+{
+	int         i, a[8];
+	short       sh[4];
+	char        c[4];
+	long        l[4];
+	struct s3   x[4];
+	struct s12  y[4];
+	struct s40  z[4];
+	struct s12 *p;
+	int        *q;
+
+	for(i = 0; i < 8; i++)
+		a[i] = i * 3;
+	if(a[0] + a[7] != 21 || a[a[1] - 1] != 6)
+		return 1;
+	for(i = 0; i < 4; i++) {
+		sh[i] = -i;
+		c[i] = i - 2;
+		l[i] = i * 100;
+		x[i].b = i + 1;
+		y[i].c = i * 7;
+		z[i].v = i + 40;
+	}
+	if(sh[3] != -3 || c[0] != -2 || c[3] != 1 || l[2] != 200)
+		return 2;
+	i = 2;
+	if(x[i].b != 3 || x[3].b != 4 || y[i].c != 14 || y[3].c != 21)
+		return 3;
+	if(z[i].v != 42 || z[3].v != 43)
+		return 4;
+	p = &y[0];
+	p = p + i;
+	if(p->c != 14 || (p + 1)->c != 21)
+		return 5;
+	q = &a[0];
+	q = q + i;
+	if(*q != 6 || q[1] != 9)
+		return 6;
+	a[i] += 100;
+	if(a[2] != 106)
+		return 7;
+	return 0;
+}
@@ -0,0 +1,51 @@
+int sprintf(char *, char *, ...);
+int strcmp(char *, char *);
+
+int
+sub(int a, int b)
+{
+	return a - b;
+}
+
+int
+eight(int a, int b, int c, int d, int e, int f, int g, int h)
+{
+	return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+
+long
+ten(long a, long b, long c, long d, long e, long f, long g, long h, long i, long j)
+{
+	return a - b + c - d + e - f + g - h + i * 1000 - j * 100;
+}
+
+int
+main()
+{
+	int  (*fp)(int, int);
+	int  x, y;
+	char buf[32];
+
+	if(sub(9, 4) != 5)
+		return 1;
+	fp = sub;
+	if(fp(4, 9) != -5)
+		return 2;
+	if(eight(1, 1, 1, 1, 1, 1, 1, 1) != 36)
+		return 3;
+	x = 3;
+	y = x + eight(x, x * 2, sub(x, 1), 0, 0, 0, x, sub(10, x));
+	if(y != 3 + 3 + 12 + 6 + 21 + 56)
+		return 4;
+	if(ten(1, 2, 3, 4, 5, 6, 7, 8, 9, 10) != -4 + 9000 - 1000)
+		return 5;
+	y = x * 2 + ten(x, 0, 0, 0, 0, 0, 0, 0, x, sub(x, 2)) - x;
+	if(y != 6 + 3 + 3000 - 100 - 3)
+		return 6;
+	if(eight(sub(8, 7), 1, 1, 1, 1, 1, 1, fp(2, 1)) != 36)
+		return 7;
+	sprintf(&buf[0], "%d-%s-%d", x, "a", eight(1, 2, 3, 4, 5, 6, 7, 8));
+	if(strcmp(&buf[0], "3-a-204") != 0)
+		return 8;
+	return 0;
+}